@@ -0,0 +1,98 @@
+/*
+ *    arena.c    --    source for per-frame memory arenas
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The arena allocator is defined here. Blocks are chained in a
+ *    list, and a reset rewinds to the first block, so after the first
+ *    few frames no further allocations reach the heap.
+ */
+#include "arena.h"
+
+#define ARENA_HEADER_SIZE ((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(u64)(ARENA_ALIGNMENT - 1))
+
+/*
+ *    Allocates memory from an arena. The memory stays valid until
+ *    the arena is reset or freed.
+ *
+ *    @param arena_t *arena    The arena.
+ *    @param u64      size     The amount of bytes to allocate.
+ *
+ *    @return void *           The memory, or NULL on failure.
+ */
+void *arena_alloc(arena_t *arena, u64 size) {
+    arena_block_t *block;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(u64)(ARENA_ALIGNMENT - 1);
+
+    /*
+     *    Move on to the next block that fits, keeping the blocks
+     *    we pass over for the next frame.
+     */
+    while (arena->cur != (arena_block_t *)0x0 && arena->cur->used + size > arena->cur->size) {
+        if (arena->cur->next == (arena_block_t *)0x0)
+            break;
+
+        arena->cur       = arena->cur->next;
+        arena->cur->used = 0;
+    }
+
+    if (arena->cur == (arena_block_t *)0x0 || arena->cur->used + size > arena->cur->size) {
+        u64 block_size = MAX(size, ARENA_BLOCK_SIZE);
+
+        block = (arena_block_t *)malloc(ARENA_HEADER_SIZE + block_size);
+
+        if (block == (arena_block_t *)0x0) {
+            LOGF_ERR("Could not allocate arena block.\n");
+            return (void *)0x0;
+        }
+
+        block->next = nullptr;
+        block->size = block_size;
+        block->used = 0;
+
+        if (arena->cur == (arena_block_t *)0x0)
+            arena->head = block;
+        else
+            arena->cur->next = block;
+
+        arena->cur = block;
+    }
+
+    block        = arena->cur;
+    block->used += size;
+
+    return (char *)block + ARENA_HEADER_SIZE + block->used - size;
+}
+
+/*
+ *    Recycles every allocation of an arena, keeping its blocks
+ *    around for reuse.
+ *
+ *    @param arena_t *arena    The arena.
+ */
+void arena_reset(arena_t *arena) {
+    arena->cur = arena->head;
+
+    if (arena->cur != (arena_block_t *)0x0)
+        arena->cur->used = 0;
+}
+
+/*
+ *    Frees the blocks of an arena.
+ *
+ *    @param arena_t *arena    The arena.
+ */
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->head;
+    arena_block_t *next;
+
+    while (block != (arena_block_t *)0x0) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head = nullptr;
+    arena->cur  = nullptr;
+}
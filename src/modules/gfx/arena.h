@@ -0,0 +1,58 @@
+/*
+ *    arena.h    --    header for per-frame memory arenas
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    An arena hands out memory linearly from large blocks, and is
+ *    recycled all at once rather than freeing individual allocations.
+ *    The rasterization stages use these for data that only lives until
+ *    the end of a frame, such as copies of submitted triangles.
+ *    Arenas are not thread safe, allocations are expected to come from
+ *    the thread submitting geometry.
+ */
+#ifndef CHIK_GFX_ARENA_H
+#define CHIK_GFX_ARENA_H
+
+#include "libchik.h"
+
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT  16
+
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+    u64                   size;
+    u64                   used;
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+    arena_block_t *cur;
+} arena_t;
+
+/*
+ *    Allocates memory from an arena. The memory stays valid until
+ *    the arena is reset or freed.
+ *
+ *    @param arena_t *arena    The arena.
+ *    @param u64      size     The amount of bytes to allocate.
+ *
+ *    @return void *           The memory, or NULL on failure.
+ */
+void *arena_alloc(arena_t *arena, u64 size);
+
+/*
+ *    Recycles every allocation of an arena, keeping its blocks
+ *    around for reuse.
+ *
+ *    @param arena_t *arena    The arena.
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ *    Frees the blocks of an arena.
+ *
+ *    @param arena_t *arena    The arena.
+ */
+void arena_free(arena_t *arena);
+
+#endif /* CHIK_GFX_ARENA_H  */
@@ -0,0 +1,416 @@
+/*
+ *    bin.c    --    source for the triangle binning stage
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The binning stage is defined here. Triangles are copied into a
+ *    per-frame arena when they are submitted, and each tile keeps a
+ *    list of indices into the triangle list, in submission order.
+ */
+#include "bin.h"
+
+#include <string.h>
+
+#include "gfx.h"
+#include "hiz.h"
+#include "vertexasm.h"
+#include "visbuf.h"
+
+/*
+ *    A bin is drawn by one worker at a time, which only keeps the
+ *    hierarchical depth tiles it covers to that worker if they line up.
+ */
+_Static_assert(BIN_TILE_SIZE % HIZ_TILE_SIZE == 0, "bins must cover whole hi-z tiles");
+
+bin_set_t       _bin_sets[2]       = {0};
+bin_set_t      *_bin_record        = &_bin_sets[0];
+bin_set_t      *_bin_kicked        = nullptr;
+u32             _bin_cols          = 0;
+u32             _bin_rows          = 0;
+unsigned int    _bin_threaded      = 0;
+unsigned int    _bin_prepass       = 0;
+unsigned int    _bin_visibility    = 0;
+
+/*
+ *    Sets up the bins for the current render target.
+ *
+ *    @return unsigned int    1 on success, 0 on failure.
+ */
+unsigned int bin_init(void) {
+    u32           x;
+    u32           y;
+    u32           s;
+    raster_rect_t target = raster_get_target_rect();
+
+    bin_free();
+
+    _bin_cols       = (target.x1 + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+    _bin_rows       = (target.y1 + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+    _bin_threaded   = args_has("--multithreaded-render") || _frame_pipelined;
+    _bin_prepass    = args_has("--depth-prepass");
+    _bin_visibility = args_has("--visibility-buffer");
+
+    /*
+     *    The visibility buffer is shaded once per render group, which
+     *    a pipelined frame only finishes as a whole.
+     */
+    if (_frame_pipelined && _bin_visibility) {
+        LOGF_ERR("The visibility buffer is not supported with pipelined frames, continuing without it.\n");
+        _bin_visibility = 0;
+    }
+
+    for (s = 0; s < (_frame_pipelined ? 2 : 1); s++) {
+        _bin_sets[s].bins = (bin_t *)malloc(sizeof(bin_t) * _bin_cols * _bin_rows);
+
+        if (_bin_sets[s].bins == (bin_t *)0x0) {
+            LOGF_ERR("Could not allocate triangle bins.\n");
+            return 0;
+        }
+
+        memset(_bin_sets[s].bins, 0, sizeof(bin_t) * _bin_cols * _bin_rows);
+
+        for (y = 0; y < _bin_rows; y++) {
+            for (x = 0; x < _bin_cols; x++) {
+                bin_t *bin = &_bin_sets[s].bins[y * _bin_cols + x];
+
+                bin->rect.x0 = x * BIN_TILE_SIZE;
+                bin->rect.y0 = y * BIN_TILE_SIZE;
+                bin->rect.x1 = MIN((int)((x + 1) * BIN_TILE_SIZE), target.x1);
+                bin->rect.y1 = MIN((int)((y + 1) * BIN_TILE_SIZE), target.y1);
+                bin->set     = &_bin_sets[s];
+            }
+        }
+    }
+
+    if (_bin_visibility && !visbuf_init(target.x1, target.y1)) {
+        LOGF_ERR("Could not create visibility buffer, continuing without it.\n");
+        _bin_visibility = 0;
+    }
+
+    return 1;
+}
+
+/*
+ *    Appends a triangle index to a bin.
+ *
+ *    @param bin_t *bin    The bin.
+ *    @param u32    idx    The index of the triangle.
+ */
+static void bin_push(bin_t *bin, u32 idx) {
+    u32 *tris;
+
+    if (bin->count == bin->capacity) {
+        tris = realloc(bin->tris, sizeof(u32) * MAX(bin->capacity * 2, 64));
+
+        if (tris == (u32 *)0x0) {
+            LOGF_ERR("Could not grow triangle bin.\n");
+            return;
+        }
+
+        bin->tris     = tris;
+        bin->capacity = MAX(bin->capacity * 2, 64);
+    }
+
+    bin->tris[bin->count++] = idx;
+}
+
+/*
+ *    Copies a triangle into every tile it overlaps.
+ *
+ *    @param triangle_t *tri    The triangle to bin.
+ */
+void bin_triangle(triangle_t *tri) {
+    u32             x;
+    u32             y;
+    int             min_x;
+    int             min_y;
+    int             max_x;
+    int             max_y;
+    u32             stride = tri->layout->stride;
+    char           *verts;
+    raster_rect_t   target = raster_get_target_rect();
+    bin_set_t      *set    = _bin_record;
+    bin_triangle_t *t;
+    vec4_t          p0     = vertex_get_position(tri->v0);
+    vec4_t          p1     = vertex_get_position(tri->v1);
+    vec4_t          p2     = vertex_get_position(tri->v2);
+
+    /*
+     *    Find the screen space bounds of the triangle, with the same
+     *    mapping the rasterizer uses, and a pixel of slack on each side.
+     */
+    min_x = (int)((MIN(MIN(p0.x, p1.x), p2.x) + 1.0f) * target.x1 / 2) - 1;
+    max_x = (int)((MAX(MAX(p0.x, p1.x), p2.x) + 1.0f) * target.x1 / 2) + 1;
+    min_y = (int)((MIN(MIN(p0.y, p1.y), p2.y) + 1.0f) * target.y1 / 2) - 1;
+    max_y = (int)((MAX(MAX(p0.y, p1.y), p2.y) + 1.0f) * target.y1 / 2) + 1;
+
+    if (max_x < 0 || max_y < 0 || min_x >= target.x1 || min_y >= target.y1) {
+        return;
+    }
+
+    min_x = MAX(min_x, 0);
+    min_y = MAX(min_y, 0);
+    max_x = MIN(max_x, target.x1 - 1);
+    max_y = MIN(max_y, target.y1 - 1);
+
+    /*
+     *    Grow the triangle list if needed. The list is kept between
+     *    frames, so this settles after the first few frames.
+     */
+    if (set->tri_count == set->tri_capacity) {
+        bin_triangle_t *tris = realloc(set->tris, sizeof(bin_triangle_t) * MAX(set->tri_capacity * 2, 1024));
+
+        if (tris == (bin_triangle_t *)0x0) {
+            LOGF_ERR("Could not grow binned triangle storage.\n");
+            return;
+        }
+
+        set->tris         = tris;
+        set->tri_capacity = MAX(set->tri_capacity * 2, 1024);
+    }
+
+    verts = arena_alloc(&set->arena, 3 * stride);
+
+    if (verts == (char *)0x0) {
+        LOGF_ERR("Could not allocate binned vertices.\n");
+        return;
+    }
+
+    memcpy(verts + 0 * stride, tri->v0, stride);
+    memcpy(verts + 1 * stride, tri->v1, stride);
+    memcpy(verts + 2 * stride, tri->v2, stride);
+
+    t           = &set->tris[set->tri_count];
+    t->verts    = verts;
+    t->assets   = tri->assets;
+    t->material = tri->material;
+    t->layout   = tri->layout;
+
+    for (y = min_y / BIN_TILE_SIZE; y <= max_y / BIN_TILE_SIZE; y++) {
+        for (x = min_x / BIN_TILE_SIZE; x <= max_x / BIN_TILE_SIZE; x++) {
+            bin_push(&set->bins[y * _bin_cols + x], set->tri_count);
+        }
+    }
+
+    set->tri_count++;
+}
+
+/*
+ *    Clears the depth of every tile before any triangle binned after
+ *    this is drawn to it. Tiles with nothing binned yet are skipped,
+ *    as nothing has been drawn to them since the frame's clear.
+ */
+void bin_mark_depth_clear(void) {
+    u32 i;
+
+    for (i = 0; i < _bin_cols * _bin_rows; i++) {
+        if (_bin_record->bins[i].count != 0)
+            bin_push(&_bin_record->bins[i], BIN_CLEAR_DEPTH);
+    }
+}
+
+/*
+ *    Rasterizes a run of a bin's triangles once, restricted to the
+ *    bin's tile.
+ *
+ *    @param bin_t *bin      The bin.
+ *    @param u32    start    The first triangle of the run.
+ *    @param u32    end      One past the last triangle of the run.
+ */
+static void bin_raster_tile_pass(bin_t *bin, u32 start, u32 end) {
+    u32             i;
+    u32             stride;
+    char           *v;
+    bin_triangle_t *t;
+
+    for (i = start; i < end; i++) {
+        t      = &bin->set->tris[bin->tris[i]];
+        v      = t->verts;
+        stride = t->layout->stride;
+
+        vertexasm_bind_layout(t->layout);
+        raster_set_triangle_id(bin->tris[i]);
+        raster_rasterize_triangle_rect(v, v + stride, v + 2 * stride, t->assets, t->material, &bin->rect);
+    }
+}
+
+/*
+ *    Rasterizes a run of a bin's triangles. With a depth prepass, the
+ *    tile's depth is settled first, and then only the visible pixels
+ *    are shaded, while the tile is in cache. With a visibility buffer,
+ *    shading is left for after every tile.
+ *
+ *    @param bin_t *bin      The bin.
+ *    @param u32    start    The first triangle of the run.
+ *    @param u32    end      One past the last triangle of the run.
+ */
+static void bin_raster_tile_run(bin_t *bin, u32 start, u32 end) {
+    if (_bin_visibility) {
+        raster_set_pass(RASTER_PASS_VISIBILITY);
+        bin_raster_tile_pass(bin, start, end);
+        raster_set_pass(RASTER_PASS_FULL);
+        return;
+    }
+
+    if (!_bin_prepass) {
+        bin_raster_tile_pass(bin, start, end);
+        return;
+    }
+
+    raster_set_pass(RASTER_PASS_DEPTH);
+    bin_raster_tile_pass(bin, start, end);
+    raster_set_pass(RASTER_PASS_SHADE);
+    bin_raster_tile_pass(bin, start, end);
+    raster_set_pass(RASTER_PASS_FULL);
+}
+
+/*
+ *    Rasterizes every triangle in a bin, restricted to the bin's tile,
+ *    clearing the tile's depth wherever the bin says to.
+ *
+ *    @param void *params    The bin.
+ */
+static void *bin_raster_tile(void *params) {
+    bin_t *bin   = (bin_t *)params;
+    u32    start = 0;
+    u32    i;
+
+    for (i = 0; i < bin->count; i++) {
+        if (bin->tris[i] != BIN_CLEAR_DEPTH)
+            continue;
+
+        bin_raster_tile_run(bin, start, i);
+        raster_clear_depth_rect(&bin->rect);
+
+        start = i + 1;
+    }
+
+    bin_raster_tile_run(bin, start, bin->count);
+
+    return nullptr;
+}
+
+/*
+ *    Hands every non-empty bin of a set to the rasterizer.
+ *
+ *    @param bin_set_t *set    The set of bins.
+ */
+static void bin_submit(bin_set_t *set) {
+    u32 i;
+
+    for (i = 0; i < _bin_cols * _bin_rows; i++) {
+        if (set->bins[i].count == 0)
+            continue;
+
+        if (_bin_threaded)
+            threadpool_submit(bin_raster_tile, &set->bins[i]);
+        else
+            bin_raster_tile(&set->bins[i]);
+    }
+}
+
+/*
+ *    Empties a set of bins.
+ *
+ *    @param bin_set_t *set    The set of bins.
+ */
+static void bin_reset(bin_set_t *set) {
+    u32 i;
+
+    for (i = 0; i < _bin_cols * _bin_rows; i++) {
+        set->bins[i].count = 0;
+    }
+
+    set->tri_count = 0;
+
+    arena_reset(&set->arena);
+}
+
+/*
+ *    Rasterizes every binned triangle, one tile at a time, and
+ *    empties the bins.
+ */
+void bin_flush(void) {
+    if (_bin_record->tri_count == 0) {
+        return;
+    }
+
+    bin_submit(_bin_record);
+
+    if (_bin_threaded)
+        threadpool_wait();
+
+    if (_bin_visibility)
+        visbuf_resolve(_bin_record->tris, _bin_threaded);
+
+    bin_reset(_bin_record);
+}
+
+/*
+ *    Starts rasterizing every binned triangle on the threadpool,
+ *    without waiting for it, and moves on to the other set of bins
+ *    for the next frame. Any kicked set is finished first.
+ */
+void bin_kick(void) {
+    bin_finish();
+
+    if (!_frame_pipelined) {
+        bin_flush();
+        return;
+    }
+
+    vertexasm_invalidate_layouts();
+
+    bin_submit(_bin_record);
+
+    _bin_kicked = _bin_record;
+    _bin_record = _bin_record == &_bin_sets[0] ? &_bin_sets[1] : &_bin_sets[0];
+}
+
+/*
+ *    Waits for the last kicked set of bins to be rasterized, and
+ *    empties it.
+ */
+void bin_finish(void) {
+    if (_bin_kicked == (bin_set_t *)0x0)
+        return;
+
+    threadpool_wait();
+    bin_reset(_bin_kicked);
+
+    _bin_kicked = nullptr;
+}
+
+/*
+ *    Frees the bins.
+ */
+void bin_free(void) {
+    u32 i;
+    u32 s;
+
+    bin_finish();
+
+    for (s = 0; s < 2; s++) {
+        if (_bin_sets[s].bins != (bin_t *)0x0) {
+            for (i = 0; i < _bin_cols * _bin_rows; i++) {
+                free(_bin_sets[s].bins[i].tris);
+            }
+
+            free(_bin_sets[s].bins);
+        }
+
+        free(_bin_sets[s].tris);
+        arena_free(&_bin_sets[s].arena);
+
+        _bin_sets[s].bins         = nullptr;
+        _bin_sets[s].tris         = nullptr;
+        _bin_sets[s].tri_count    = 0;
+        _bin_sets[s].tri_capacity = 0;
+    }
+
+    visbuf_free();
+
+    _bin_record = &_bin_sets[0];
+    _bin_cols   = 0;
+    _bin_rows   = 0;
+}
@@ -0,0 +1,101 @@
+/*
+ *    bin.h    --    header for the triangle binning stage
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The binning stage sorts triangles into screen-space tiles
+ *    before rasterization. Once a frame has been submitted, each
+ *    tile is rasterized on its own, so that a single worker keeps
+ *    the tile's color and depth rows in cache, and no two workers
+ *    write to the same part of the render target.
+ *
+ *    With pipelined frames there are two sets of bins. One is being
+ *    rasterized by the workers while the next frame is recorded into
+ *    the other.
+ */
+#ifndef CHIK_GFX_BIN_H
+#define CHIK_GFX_BIN_H
+
+#include "libchik.h"
+
+#include "arena.h"
+#include "raster.h"
+
+#define BIN_TILE_SIZE 64
+
+/*
+ *    An index in a bin that clears the bin's depth, in place of a
+ *    triangle, between render groups of a pipelined frame.
+ */
+#define BIN_CLEAR_DEPTH 0xffffffff
+
+typedef struct {
+    char       *verts;
+    void       *assets;
+    material_t *material;
+    v_layout_t *layout;
+} bin_triangle_t;
+
+struct bin_set_s;
+
+typedef struct {
+    u32               *tris;
+    u32                count;
+    u32                capacity;
+    raster_rect_t      rect;
+    struct bin_set_s  *set;
+} bin_t;
+
+typedef struct bin_set_s {
+    bin_t          *bins;
+    bin_triangle_t *tris;
+    u32             tri_count;
+    u32             tri_capacity;
+    arena_t         arena;
+} bin_set_t;
+
+/*
+ *    Sets up the bins for the current render target.
+ *
+ *    @return unsigned int    1 on success, 0 on failure.
+ */
+unsigned int bin_init(void);
+
+/*
+ *    Copies a triangle into every tile it overlaps.
+ *
+ *    @param triangle_t *tri    The triangle to bin.
+ */
+void bin_triangle(triangle_t *tri);
+
+/*
+ *    Rasterizes every binned triangle, one tile at a time, and
+ *    empties the bins.
+ */
+void bin_flush(void);
+
+/*
+ *    Starts rasterizing every binned triangle on the threadpool,
+ *    without waiting for it, and moves on to the other set of bins
+ *    for the next frame.
+ */
+void bin_kick(void);
+
+/*
+ *    Waits for the last kicked set of bins to be rasterized, and
+ *    empties it.
+ */
+void bin_finish(void);
+
+/*
+ *    Clears the depth of every tile before any triangle binned
+ *    after this is drawn to it.
+ */
+void bin_mark_depth_clear(void);
+
+/*
+ *    Frees the bins.
+ */
+void bin_free(void);
+
+#endif /* CHIK_GFX_BIN_H  */
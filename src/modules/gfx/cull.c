@@ -9,25 +9,71 @@
  */
 #include "cull.h"
 
+#include <math.h>
 #include <string.h>
 
 #include "camera.h"
+#include "raster.h"
 #include "vertexasm.h"
 
-frustum_t    _frustum;
-unsigned int _vert_size = 0;
+float        _clip_near = 0.1f;
+float        _clip_far  = 100.f;
 
 /*
- *    Sets the current vertex size.
+ *    The planes the clipper cuts triangles against, in order. The
+ *    sides use the guard band, so only triangles reaching far past
+ *    the edges of the screen are cut, and the rest are left to the
+ *    rasterizer's scissor.
+ */
+static const unsigned int _clip_planes[] = {
+    CULL_PLANE_NEAR,
+    CULL_PLANE_GUARD_LEFT,
+    CULL_PLANE_GUARD_RIGHT,
+    CULL_PLANE_GUARD_TOP,
+    CULL_PLANE_GUARD_BOTTOM,
+    CULL_PLANE_FAR,
+};
+
+/*
+ *    Returns the signed distance of a clip space position from a clip
+ *    plane, positive on the inside.
  *
- *    @param unsigned int size           The size of the vertex data.
+ *    @param unsigned int plane    The CULL_PLANE_* to measure against.
+ *    @param vec4_t      *p        The clip space position.
+ *
+ *    @return float                The signed distance.
  */
-void cull_set_vertex_size(unsigned int size) { _vert_size = size; }
+static float cull_plane_distance(unsigned int plane, vec4_t *p) {
+    switch (plane) {
+        case CULL_PLANE_NEAR:
+            return p->z - _clip_near;
+        case CULL_PLANE_LEFT:
+            return p->x + p->w;
+        case CULL_PLANE_RIGHT:
+            return p->w - p->x;
+        case CULL_PLANE_TOP:
+            return p->w - p->y;
+        case CULL_PLANE_BOTTOM:
+            return p->y + p->w;
+        case CULL_PLANE_FAR:
+            return _clip_far - p->z;
+        case CULL_PLANE_GUARD_LEFT:
+            return p->x + CULL_GUARD_BAND * p->w;
+        case CULL_PLANE_GUARD_RIGHT:
+            return CULL_GUARD_BAND * p->w - p->x;
+        case CULL_PLANE_GUARD_TOP:
+            return CULL_GUARD_BAND * p->w - p->y;
+        case CULL_PLANE_GUARD_BOTTOM:
+            return p->y + CULL_GUARD_BAND * p->w;
+    }
+
+    return 0.f;
+}
 
 /*
  *    Clips a pair of vertices.
  *
- *    @param plane_t       *plane    The plane to clip against.
+ *    @param unsigned int   plane    The CULL_PLANE_* to clip against.
  *    @param void          *v0       The first vertex.
  *    @param void          *v1       The second vertex.
  *    @param void          *ret      The clipped vertex.
@@ -39,14 +85,14 @@ void cull_set_vertex_size(unsigned int size) { _vert_size = size; }
  *                              0x2 = modify the first vertex of the array.
  *
  */
-unsigned int cull_clip_vertex(plane_t *plane, void *v0, void *v1, void *ret, unsigned int first) {
+unsigned int cull_clip_vertex(unsigned int plane, void *v0, void *v1, void *ret, unsigned int first) {
     float t;
 
     vec4_t p0 = vertex_get_position(v0);
     vec4_t p1 = vertex_get_position(v1);
 
-    float outside      = plane_distance(plane, (vec3_t *)&p0);
-    float next_outside = plane_distance(plane, (vec3_t *)&p1);
+    float outside      = cull_plane_distance(plane, &p0);
+    float next_outside = cull_plane_distance(plane, &p1);
     /*
      *    Check if the triangle is outside the frustum.
      */
@@ -55,7 +101,7 @@ unsigned int cull_clip_vertex(plane_t *plane, void *v0, void *v1, void *ret, uns
         /*
          *    Generate a new vertex.
          */
-        memcpy(ret, vertex_build_interpolated(v0, v1, t), _vert_size);
+        vertex_interpolate(ret, v0, v1, t);
         /*
          *    If our initial vertex is inside, append the new vertex.
          */
@@ -104,14 +150,13 @@ unsigned int cull_clip_vertex(plane_t *plane, void *v0, void *v1, void *ret, uns
  *    Inserts a vertex into a clipped vertex list.
  *
  *    @param void           *v        The vertex to insert.
- *    @param void          **list     The list of vertices.
- *    @param unsigned int             idx      The target index.
- *    @param unsigned int             count    The number of vertices in the list.
- *    @param unsigned int             len      The list size.
+ *    @param void           *list     The list of vertices.
+ *    @param unsigned int    idx      The target index.
+ *    @param unsigned int    count    The number of vertices in the list.
+ *    @param unsigned int    len      The list size.
+ *    @param unsigned int    stride   The size of a vertex.
  */
-void cull_insert_vertex(void *v, void **list, unsigned int idx, unsigned int count, unsigned int len) {
-    size_t i;
-
+void cull_insert_vertex(void *v, void *list, unsigned int idx, unsigned int count, unsigned int len, unsigned int stride) {
     if (idx >= len) {
         LOGF_ERR("Index out of bounds.\n");
         return;
@@ -122,196 +167,268 @@ void cull_insert_vertex(void *v, void **list, unsigned int idx, unsigned int cou
     }
 
     /*
-     *    Shift the vertices down.
+     *    Shift the vertices down, and insert the vertex.
      */
-    for (i = count; i > idx; i--) {
-        memcpy((unsigned char *)list + i * VERTEX_ASM_MAX_VERTEX_SIZE,
-               (unsigned char *)list + (i - 1) * VERTEX_ASM_MAX_VERTEX_SIZE, _vert_size);
-    }
-
-    /*
-     *    Insert the vertex.
-     */
-    memcpy((unsigned char *)list + idx * VERTEX_ASM_MAX_VERTEX_SIZE, v, _vert_size);
+    memmove((unsigned char *)list + (idx + 1) * stride, (unsigned char *)list + idx * stride, (count - idx) * stride);
+    memcpy((unsigned char *)list + idx * stride, v, stride);
 }
 
 /*
  *    Removes a vertex from a clipped vertex list.
  *
- *    @param unsigned int             idx      The index to remove.
- *    @param void          **list     The list of vertices.
- *    @param unsigned int             count    The number of vertices in the list.
- *    @param unsigned int             len     The list size.
+ *    @param unsigned int    idx      The index to remove.
+ *    @param void           *list     The list of vertices.
+ *    @param unsigned int    count    The number of vertices in the list.
+ *    @param unsigned int    stride   The size of a vertex.
  */
-void cull_remove_vertex(unsigned int idx, void **list, unsigned int len, unsigned int sSize) {
-    size_t i;
-
-    if (idx >= sSize) {
+void cull_remove_vertex(unsigned int idx, void *list, unsigned int count, unsigned int stride) {
+    if (idx >= count) {
         LOGF_ERR("Index out of bounds.\n");
         return;
     }
-    if (len <= 0) {
-        LOGF_ERR("List is empty.\n");
-        return;
-    }
+
     /*
      *    Shift the vertices up.
      */
-    for (i = idx; i < len - 1; i++) {
-        /*
-         *    The scope doesn't seem to know that void **list is a unsigned char[][], so
-         * we'll use direct memory access. I hope this works on other platforms.
-         */
-        memcpy((unsigned char *)list + i * VERTEX_ASM_MAX_VERTEX_SIZE,
-               (unsigned char *)list + (i + 1) * VERTEX_ASM_MAX_VERTEX_SIZE, _vert_size);
-    }
+    memmove((unsigned char *)list + idx * stride, (unsigned char *)list + (idx + 1) * stride, (count - idx - 1) * stride);
 }
 
 /*
- *    Creates the view frustum.
+ *    Creates the view frustum, picking up the near and far planes
+ *    of the current camera.
  */
 void cull_create_frustum() {
-    float n = 0.1;
-    float f = 100;
+    if (!_camera) {
+        _clip_near = 0.1f;
+        _clip_far  = 100.f;
+    } else {
+        _clip_near = _camera->near;
+        _clip_far  = _camera->far;
+    }
+}
 
-    vec2_t nsw = {-n, -n};
-    vec2_t nse = {n, -n};
-    vec2_t nne = {n, n};
-    vec2_t nnw = {-n, n};
+/*
+ *    Works out which clip planes a clip space position is outside of.
+ *
+ *    @param vec4_t p             The position, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                position is outside of that plane.
+ */
+unsigned int cull_position_outcode(vec4_t p) {
+    float        g    = CULL_GUARD_BAND * p.w;
+    unsigned int code = 0;
+
+    code |= (p.z < _clip_near) << CULL_PLANE_NEAR;
+    code |= (p.x < -p.w) << CULL_PLANE_LEFT;
+    code |= (p.x > p.w) << CULL_PLANE_RIGHT;
+    code |= (p.y > p.w) << CULL_PLANE_TOP;
+    code |= (p.y < -p.w) << CULL_PLANE_BOTTOM;
+    code |= (p.z > _clip_far) << CULL_PLANE_FAR;
+    code |= (p.x < -g) << CULL_PLANE_GUARD_LEFT;
+    code |= (p.x > g) << CULL_PLANE_GUARD_RIGHT;
+    code |= (p.y > g) << CULL_PLANE_GUARD_TOP;
+    code |= (p.y < -g) << CULL_PLANE_GUARD_BOTTOM;
+
+    return code;
+}
 
-    vec2_t fsw = {-f, -f};
-    vec2_t fse = {f, -f};
-    vec2_t fne = {f, f};
-    vec2_t fnw = {-f, f};
+/*
+ *    Works out which clip planes a transformed sphere is entirely
+ *    outside of.
+ *
+ *    @param vec4_t  c            The center, in clip space.
+ *    @param vec4_t *axes         The three radii, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                whole sphere is outside of that plane.
+ */
+unsigned int cull_sphere_outcode(vec4_t c, vec4_t *axes) {
+    /*
+     *    Each plane as the distance of the center, with the part that
+     *    grows with the position given as x, y, z and w factors.
+     */
+    float planes[6][5] = {
+        [CULL_PLANE_NEAR]   = {0.f, 0.f, 1.f, 0.f, c.z - _clip_near},
+        [CULL_PLANE_LEFT]   = {1.f, 0.f, 0.f, 1.f, c.x + c.w},
+        [CULL_PLANE_RIGHT]  = {-1.f, 0.f, 0.f, 1.f, c.w - c.x},
+        [CULL_PLANE_TOP]    = {0.f, -1.f, 0.f, 1.f, c.w - c.y},
+        [CULL_PLANE_BOTTOM] = {0.f, 1.f, 0.f, 1.f, c.y + c.w},
+        [CULL_PLANE_FAR]    = {0.f, 0.f, -1.f, 0.f, _clip_far - c.z},
+    };
+    unsigned int code = 0;
+
+    for (u32 i = 0; i < 6; i++) {
+        float reach = 0.f;
 
-    vec3_t nearTop   = {nnw.x, nnw.y, n};
-    vec3_t nearBot   = {nsw.x, nsw.y, n};
-    vec3_t nearRight = {nne.x, nne.y, n};
+        /*
+         *    The furthest the ellipsoid reaches towards the plane.
+         */
+        for (u32 j = 0; j < 3; j++) {
+            float d = planes[i][0] * axes[j].x + planes[i][1] * axes[j].y +
+                      planes[i][2] * axes[j].z + planes[i][3] * axes[j].w;
 
-    vec3_t leftCloseBottom = {nsw.x, nsw.y, n};
-    vec3_t leftCloseTop    = {nnw.x, nnw.y, n};
-    vec3_t leftFarTop      = {fnw.x, fnw.y, f};
+            reach += d * d;
+        }
 
-    vec3_t rightCloseBottom = {nse.x, nse.y, n};
-    vec3_t rightFarBottom   = {fse.x, fse.y, f};
-    vec3_t rightFarTop      = {fne.x, fne.y, f};
+        code |= (planes[i][4] + sqrtf(reach) < 0.f) << i;
+    }
 
-    vec3_t topCloseLeft  = {nnw.x, nnw.y, n};
-    vec3_t topCloseRight = {nne.x, nne.y, n};
-    vec3_t topFarLeft    = {fnw.x, fnw.y, f};
+    return code;
+}
 
-    vec3_t bottomFarRight  = {fse.x, fse.y, f};
-    vec3_t bottomCloseLeft = {nsw.x, nsw.y, n};
-    vec3_t bottomFarLeft   = {fsw.x, fsw.y, f};
+/*
+ *    Works out which clip planes a vertex is outside of.
+ *
+ *    @param void *v              The vertex, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                vertex is outside of that plane.
+ */
+unsigned int cull_vertex_outcode(void *v) {
+    return cull_position_outcode(vertex_get_position(v));
+}
 
-    vec3_t farTop   = {fnw.x, fnw.y, f};
-    vec3_t farRight = {fne.x, fne.y, f};
-    vec3_t farBot   = {fsw.x, fsw.y, f};
+/*
+ *    Classifies a triangle against the view frustum.
+ *
+ *    @param void *v0             The first vertex.
+ *    @param void *v1             The second vertex.
+ *    @param void *v2             The third vertex.
+ *    @param unsigned int *planes The planes the triangle crosses, if any.
+ *
+ *    @return unsigned int        CULL_INSIDE, CULL_OUTSIDE or CULL_CLIP.
+ */
+unsigned int cull_classify_triangle(void *v0, void *v1, void *v2, unsigned int *planes) {
+    unsigned int c0 = cull_vertex_outcode(v0);
+    unsigned int c1 = cull_vertex_outcode(v1);
+    unsigned int c2 = cull_vertex_outcode(v2);
 
-    if (!_camera) {
-        n = 0.1f;
-        f = 100.f;
-    } else {
-        n = _camera->near;
-        f = _camera->far;
-    }
+    if (planes != (unsigned int *)0x0)
+        *planes = c0 | c1 | c2;
 
     /*
-     *    Plane 0:    Near.
-     *    This plane consists of the three points:
-     *    the top-left, bottom-left, and bottom-right.
+     *    Every vertex being outside of the same frustum plane means the
+     *    whole triangle is.
      */
-    plane_from_points(&_frustum.planes[0], &nearTop, &nearBot, &nearRight);
+    if (c0 & c1 & c2 & CULL_FRUSTUM_MASK)
+        return CULL_OUTSIDE;
 
     /*
-     *    Plane 1:    Left.
-     *    This plane consists of the three points ( when directly facing this
-     * plane from outside the frustum as if looking through the game camera ):
-     *    the bottom-right, top-right, and top-left.
+     *    Overshooting the sides of the screen is fine so long as the
+     *    triangle stays within the guard band.
      */
-    plane_from_points(&_frustum.planes[1], &leftCloseBottom, &leftCloseTop,
-                      &leftFarTop);
+    if (((c0 | c1 | c2) & CULL_CLIP_MASK) == 0)
+        return CULL_INSIDE;
 
-    /*
-     *    Plane 2:    Right.
-     *    This plane consists of the three points ( same conditions as above,
-     * same for below ): the bottom-left, bottom-right, and top-right.
-     */
-    plane_from_points(&_frustum.planes[2], &rightCloseBottom, &rightFarBottom,
-                      &rightFarTop);
+    return CULL_CLIP;
+}
 
-    /*
-     *    Plane 3:    Top.
-     *    This plane consists of the three points:
-     *    the bottom-left, bottom-right, and top-left.
-     */
-    plane_from_points(&_frustum.planes[3], &topCloseLeft, &topCloseRight,
-                      &topFarLeft);
+/*
+ *    Checks whether a projected triangle can be skipped, either for
+ *    facing the culled way, or for covering no pixel centers at all.
+ *
+ *    @param void *v0             The first vertex, after the perspective divide.
+ *    @param void *v1             The second vertex, after the perspective divide.
+ *    @param void *v2             The third vertex, after the perspective divide.
+ *    @param cull_face_e mode     Which faces to cull.
+ *
+ *    @return unsigned int        1 if the triangle can be skipped, 0 otherwise.
+ */
+unsigned int cull_projected_triangle(void *v0, void *v1, void *v2, cull_face_e mode) {
+    raster_rect_t target = raster_get_target_rect();
+
+    vec4_t p0 = vertex_get_position(v0);
+    vec4_t p1 = vertex_get_position(v1);
+    vec4_t p2 = vertex_get_position(v2);
 
     /*
-     *    Plane 4:    Bottom.
-     *    This plane consists of the three points:
-     *    the bottom-right, bottom-left, and top-left.
+     *    Work in pixels, the same way the rasterizers map positions.
      */
-    plane_from_points(&_frustum.planes[4], &bottomFarRight, &bottomCloseLeft,
-                      &bottomFarLeft);
+    float x0 = (p0.x + 1.f) * target.x1 / 2;
+    float y0 = (p0.y + 1.f) * target.y1 / 2;
+    float x1 = (p1.x + 1.f) * target.x1 / 2;
+    float y1 = (p1.y + 1.f) * target.y1 / 2;
+    float x2 = (p2.x + 1.f) * target.x1 / 2;
+    float y2 = (p2.y + 1.f) * target.y1 / 2;
+
+    float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+
+    if (area == 0.f || area != area)
+        return 1;
+
+    if (mode == CULL_FACE_BACK && area < 0.f)
+        return 1;
+
+    if (mode == CULL_FACE_FRONT && area > 0.f)
+        return 1;
 
     /*
-     *    Plane 5:    Far.
-     *    This plane consists of the three points:
-     *    the top-left, top-right, bottom-left.
+     *    A triangle whose bounds hold no pixel center in either axis
+     *    would not be drawn anyway.
      */
-    plane_from_points(&_frustum.planes[5], &farTop, &farRight, &farBot);
+    if (floorf(MAX(MAX(x0, x1), x2) - 0.5f) < ceilf(MIN(MIN(x0, x1), x2) - 0.5f))
+        return 1;
+
+    if (floorf(MAX(MAX(y0, y1), y2) - 0.5f) < ceilf(MIN(MIN(y0, y1), y2) - 0.5f))
+        return 1;
+
+    return 0;
 }
 
 /*
- *    Clips a triangle.
+ *    Clips a triangle into a polygon.
+ *
+ *    Nothing is kept between calls, so triangles can be clipped on
+ *    several threads at once, each with its own scratch.
  *
  *    Reference: https://youtu.be/hxOw_p0kLfI
  *
  *    @param void *v0             The first vertex.
  *    @param void *v1             The second vertex.
  *    @param void *v2             The third vertex.
- *    @param int  *num_verts      The number of new vertices.
- *    @param unsigned int   is_clipped     Whether or not to clip the triangle.
+ *    @param void *out            Scratch of CULL_CLIP_SCRATCH_SIZE( stride )
+ *                                bytes, which receives the polygon's
+ *                                vertices packed at stride.
+ *    @param unsigned int stride  The size of a vertex.
  *
- *    @return void *    The new vertices.
+ *    @return int                 The number of vertices in the polygon.
  */
-void *cull_clip_triangle(void *v0, void *v1, void *v2, int *num_verts,
-                         unsigned int is_clipped) {
-    size_t i;
-    size_t j;
-    unsigned int  remove_first;
-    unsigned int  ret;
-
-    /*
-     *    TODO:    This used to be eight, but I changed it to sixteen
-     *             because for some reason, eleven clipped vertices
-     *             were being returned, overwriting platform_draw_image
-     */
-    static unsigned char vertices[16 * VERTEX_ASM_MAX_VERTEX_SIZE];
-    unsigned char        v[VERTEX_ASM_MAX_VERTEX_SIZE];
-
-    *num_verts = 3;
+int cull_clip_triangle(void *v0, void *v1, void *v2, void *out, unsigned int stride) {
+    size_t         i;
+    size_t         j;
+    unsigned int   remove_first;
+    unsigned int   ret;
+    unsigned int   planes;
+    int            num_verts = 3;
+    unsigned char *vertices  = (unsigned char *)out;
+    unsigned char *v         = vertices + CULL_MAX_CLIP_VERTICES * stride;
+
+    if (cull_classify_triangle(v0, v1, v2, &planes) == CULL_OUTSIDE) {
+        return 0;
+    }
 
     /*
      *    Copy the vertices into the array.
      */
-    memcpy(vertices + 0 * VERTEX_ASM_MAX_VERTEX_SIZE, v0, _vert_size);
-    memcpy(vertices + 1 * VERTEX_ASM_MAX_VERTEX_SIZE, v1, _vert_size);
-    memcpy(vertices + 2 * VERTEX_ASM_MAX_VERTEX_SIZE, v2, _vert_size);
+    memcpy(vertices + 0 * stride, v0, stride);
+    memcpy(vertices + 1 * stride, v1, stride);
+    memcpy(vertices + 2 * stride, v2, stride);
 
-    if (!is_clipped) {
-        return vertices;
-    }
+    for (i = 0; i < ARR_LEN(_clip_planes); ++i) {
+        /*
+         *    Only planes that a vertex is outside of can cut the triangle,
+         *    so a triangle inside of the guard band skips the loop.
+         */
+        if (!(planes & CULL_CLIP_MASK & (1 << _clip_planes[i])))
+            continue;
 
-    for (i = 0; i < ARR_LEN(_frustum.planes); ++i) {
         remove_first = 0;
-        for (j = 0; j < *num_verts;) {
+        for (j = 0; j < num_verts;) {
             ret = cull_clip_vertex(
-                &_frustum.planes[i], &vertices[j * VERTEX_ASM_MAX_VERTEX_SIZE],
-                &vertices[(j + 1) % (*num_verts) * VERTEX_ASM_MAX_VERTEX_SIZE],
-                &v, j == 0);
+                _clip_planes[i], vertices + j * stride,
+                vertices + (j + 1) % num_verts * stride,
+                v, j == 0);
 
             /*
              *    Remove the first vertex once we are at the end of the loop.
@@ -328,9 +445,9 @@ void *cull_clip_triangle(void *v0, void *v1, void *v2, int *num_verts,
                  *    Insert the new clipped vertex.
                  */
                 if (ret & 0b00000010) {
-                    cull_insert_vertex(&v, (void **)&vertices, ++j, *num_verts,
-                                       ARR_LEN(vertices));
-                    (*num_verts)++;
+                    cull_insert_vertex(v, vertices, ++j, num_verts,
+                                       CULL_MAX_CLIP_VERTICES, stride);
+                    num_verts = MIN(num_verts + 1, CULL_MAX_CLIP_VERTICES);
                 }
                 /*
                  *    No need to insert the new vertex.
@@ -340,15 +457,13 @@ void *cull_clip_triangle(void *v0, void *v1, void *v2, int *num_verts,
                 /*
                  *    Replace the first vertex.
                  */
-                memcpy(vertices + j * VERTEX_ASM_MAX_VERTEX_SIZE, &v,
-                       _vert_size);
+                memcpy(vertices + j * stride, v, stride);
                 ++j;
             } else {
                 /*
                  *    Erase the first vertex.
                  */
-                cull_remove_vertex(j, (void **)&vertices, (*num_verts)--,
-                                   ARR_LEN(vertices));
+                cull_remove_vertex(j, vertices, num_verts--, stride);
             }
         }
         /*
@@ -356,10 +471,9 @@ void *cull_clip_triangle(void *v0, void *v1, void *v2, int *num_verts,
          * vertex occasionally.
          */
         if (remove_first) {
-            cull_remove_vertex(0, (void **)&vertices, (*num_verts)--,
-                               ARR_LEN(vertices));
+            cull_remove_vertex(0, vertices, num_verts--, stride);
         }
     }
 
-    return (void *)vertices;
-}
\ No newline at end of file
+    return num_verts;
+}
@@ -5,26 +5,67 @@
  *
  *    This file is part of the Chik engine.
  *
- *    As of now, the culling routines consist of just frustum culling,
- *    which tests a line segment against a plane, and interpolates a new
- *    point on the line segment if it intersects the plane.
+ *    The culling routines classify triangles against the view frustum
+ *    by the outcodes of their vertices, reject back facing, degenerate
+ *    and sub-pixel triangles once projected, and clip whatever is left
+ *    straddling a plane, interpolating a new point wherever an edge
+ *    crosses it.
+ *
+ *    Clipping happens in homogeneous clip space, before the perspective
+ *    divide. Only the near and far planes, and a guard band well past
+ *    the sides of the screen, actually cut triangles.
  */
 #ifndef CHIK_GFX_CULL_H
 #define CHIK_GFX_CULL_H
 
 #include "libchik.h"
 
+#define CULL_INSIDE  0
+#define CULL_OUTSIDE 1
+#define CULL_CLIP    2
+
+#define CULL_PLANE_NEAR         0
+#define CULL_PLANE_LEFT         1
+#define CULL_PLANE_RIGHT        2
+#define CULL_PLANE_TOP          3
+#define CULL_PLANE_BOTTOM       4
+#define CULL_PLANE_FAR          5
+#define CULL_PLANE_GUARD_LEFT   6
+#define CULL_PLANE_GUARD_RIGHT  7
+#define CULL_PLANE_GUARD_TOP    8
+#define CULL_PLANE_GUARD_BOTTOM 9
+
+#define CULL_FRUSTUM_MASK 0x03f
+#define CULL_CLIP_MASK    0x3e1
+
 /*
- *    Sets the current vertex size.
- *
- *    @param unsigned int size           The size of the vertex data.
+ *    How far past the screen the guard band reaches, as a multiple of
+ *    the screen's half extent.
  */
-void cull_set_vertex_size(unsigned int size);
+#define CULL_GUARD_BAND 4.f
+
+/*
+ *    Cutting a triangle by the six clip planes adds at most one
+ *    vertex per plane, plus one while a plane is being walked.
+ */
+#define CULL_MAX_CLIP_VERTICES (3 + 6 + 1)
+
+/*
+ *    The scratch cull_clip_triangle needs for vertices of a stride,
+ *    the clipped polygon plus one vertex being generated.
+ */
+#define CULL_CLIP_SCRATCH_SIZE(stride) ((CULL_MAX_CLIP_VERTICES + 1) * (stride))
+
+typedef enum {
+    CULL_FACE_NONE = 0,
+    CULL_FACE_BACK,
+    CULL_FACE_FRONT,
+} cull_face_e;
 
 /*
  *    Clips a pair of vertices.
  *
- *    @param plane_t       *plane    The plane to clip against.
+ *    @param unsigned int   plane    The CULL_PLANE_* to clip against.
  *    @param void          *v0       The first vertex.
  *    @param void          *v1       The second vertex.
  *    @param void          *ret      The clipped vertex.
@@ -36,48 +77,115 @@ void cull_set_vertex_size(unsigned int size);
  *                              0x2 = modify the first vertex of the array.
  *
  */
-unsigned int cull_clip_vertex(plane_t *plane, void *v0, void *v1, void *ret, unsigned int first);
+unsigned int cull_clip_vertex(unsigned int plane, void *v0, void *v1, void *ret, unsigned int first);
 
 /*
  *    Inserts a vertex into a clipped vertex list.
  *
  *    @param void           *v        The vertex to insert.
- *    @param void          **list     The list of vertices.
- *    @param unsigned int             idx      The target index.
- *    @param unsigned int             count    The number of vertices in the list.
- *    @param unsigned int             len      The list size.
+ *    @param void           *list     The list of vertices.
+ *    @param unsigned int    idx      The target index.
+ *    @param unsigned int    count    The number of vertices in the list.
+ *    @param unsigned int    len      The list size.
+ *    @param unsigned int    stride   The size of a vertex.
  */
-void cull_insert_vertex(void *v, void **list, unsigned int idx, unsigned int count, unsigned int len);
+void cull_insert_vertex(void *v, void *list, unsigned int idx, unsigned int count, unsigned int len, unsigned int stride);
 
 /*
  *    Removes a vertex from a clipped vertex list.
  *
- *    @param unsigned int             idx      The index to remove.
- *    @param void          **list     The list of vertices.
- *    @param unsigned int             count    The number of vertices in the list.
- *    @param unsigned int             len     The list size.
+ *    @param unsigned int    idx      The index to remove.
+ *    @param void           *list     The list of vertices.
+ *    @param unsigned int    count    The number of vertices in the list.
+ *    @param unsigned int    stride   The size of a vertex.
  */
-void cull_remove_vertex(unsigned int idx, void **list, unsigned int len, unsigned int sSize);
+void cull_remove_vertex(unsigned int idx, void *list, unsigned int count, unsigned int stride);
 
 /*
- *    Creates the view frustum.
+ *    Creates the view frustum, picking up the near and far planes
+ *    of the current camera.
  */
 void cull_create_frustum();
 
 /*
- *    Clips a triangle.
+ *    Works out which clip planes a clip space position is outside of.
+ *
+ *    @param vec4_t p             The position, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                position is outside of that plane.
+ */
+unsigned int cull_position_outcode(vec4_t p);
+
+/*
+ *    Works out which clip planes a transformed sphere is entirely
+ *    outside of. Under an affine transform a sphere becomes an
+ *    ellipsoid, given by its center and the images of its three radii.
+ *
+ *    @param vec4_t  c            The center, in clip space.
+ *    @param vec4_t *axes         The three radii, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                whole sphere is outside of that plane.
+ */
+unsigned int cull_sphere_outcode(vec4_t c, vec4_t *axes);
+
+/*
+ *    Works out which clip planes a vertex is outside of.
+ *
+ *    @param void *v              The vertex, in clip space.
+ *
+ *    @return unsigned int        Bitmask with bit CULL_PLANE_* set if the
+ *                                vertex is outside of that plane.
+ */
+unsigned int cull_vertex_outcode(void *v);
+
+/*
+ *    Classifies a triangle against the view frustum, so that triangles
+ *    entirely inside or outside of it can skip clipping.
+ *
+ *    @param void *v0             The first vertex.
+ *    @param void *v1             The second vertex.
+ *    @param void *v2             The third vertex.
+ *    @param unsigned int *planes The planes the triangle crosses, if any.
+ *
+ *    @return unsigned int        CULL_INSIDE, CULL_OUTSIDE or CULL_CLIP.
+ */
+unsigned int cull_classify_triangle(void *v0, void *v1, void *v2, unsigned int *planes);
+
+/*
+ *    Checks whether a projected triangle can be skipped, either for
+ *    facing the culled way, or for covering no pixel centers at all.
+ *    Counter-clockwise triangles in normalized device coordinates
+ *    are front facing.
+ *
+ *    @param void *v0             The first vertex, after the perspective divide.
+ *    @param void *v1             The second vertex, after the perspective divide.
+ *    @param void *v2             The third vertex, after the perspective divide.
+ *    @param cull_face_e mode     Which faces to cull.
+ *
+ *    @return unsigned int        1 if the triangle can be skipped, 0 otherwise.
+ */
+unsigned int cull_projected_triangle(void *v0, void *v1, void *v2, cull_face_e mode);
+
+/*
+ *    Clips a triangle into a polygon.
+ *
+ *    Nothing is kept between calls, so triangles can be clipped on
+ *    several threads at once, each with its own scratch.
  *
  *    Reference: https://youtu.be/hxOw_p0kLfI
  *
  *    @param void *v0             The first vertex.
  *    @param void *v1             The second vertex.
  *    @param void *v2             The third vertex.
- *    @param int  *num_verts      The number of new vertices.
- *    @param unsigned int   is_clipped     Whether or not to clip the triangle.
+ *    @param void *out            Scratch of CULL_CLIP_SCRATCH_SIZE( stride )
+ *                                bytes, which receives the polygon's
+ *                                vertices packed at stride.
+ *    @param unsigned int stride  The size of a vertex.
  *
- *    @return void *    The new vertices.
+ *    @return int                 The number of vertices in the polygon.
  */
-void *cull_clip_triangle(void *v0, void *v1, void *v2, int *num_verts,
-                         unsigned int is_clipped);
+int cull_clip_triangle(void *v0, void *v1, void *v2, void *out, unsigned int stride);
 
 #endif /* CHIK_GFX_CULL_H  */
\ No newline at end of file
@@ -0,0 +1,165 @@
+/*
+ *    depth.c    --    source for depth buffers
+ *
+ *    This file is part of the Chik engine.
+ */
+#include "depth.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DEPTH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEPTH_SSE2
+#endif
+
+extern float _clip_far;
+
+/*
+ *    Creates a depth buffer.
+ *
+ *    @param u32 width          The width of the depth buffer.
+ *    @param u32 height         The height of the depth buffer.
+ *    @param depth_fmt_e fmt    The format of the depth buffer.
+ *
+ *    @return depthbuffer_t *   The depth buffer, or NULL on failure.
+ */
+depthbuffer_t *depthbuffer_create(u32 width, u32 height, depth_fmt_e fmt) {
+    depthbuffer_t *db = malloc(sizeof(depthbuffer_t));
+
+    if (db == (depthbuffer_t *)0x0) {
+        LOGF_ERR("Could not allocate depth buffer.\n");
+        return (depthbuffer_t *)0x0;
+    }
+
+    db->width  = width;
+    db->height = height;
+    db->fmt    = fmt;
+    db->scale  = 1.f;
+    db->clear  = 0;
+    db->buf    = malloc((u64)width * height * (fmt == DEPTH_FMT_UNORM16 ? sizeof(u16) : sizeof(u32)));
+
+    if (db->buf == (void *)0x0) {
+        LOGF_ERR("Could not allocate depth buffer.\n");
+        free(db);
+        return (depthbuffer_t *)0x0;
+    }
+
+    depthbuffer_clear(db);
+
+    return db;
+}
+
+/*
+ *    Works out the value a depth buffer clears to, without clearing
+ *    it, for clears that are filled in later a piece at a time. Unorm
+ *    buffers are rescaled to the current far plane, which nothing drawn
+ *    can lie beyond.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_begin_clear(depthbuffer_t *db) {
+    float clear = DEPTH_CLEAR;
+
+    switch (db->fmt) {
+        case DEPTH_FMT_F32:
+            memcpy(&db->clear, &clear, sizeof(db->clear));
+            break;
+        case DEPTH_FMT_UNORM24:
+            db->clear = 0xffffff;
+            db->scale = db->clear / _clip_far;
+            break;
+        case DEPTH_FMT_UNORM16:
+            db->clear = 0xffff;
+            db->scale = db->clear / _clip_far;
+            break;
+    }
+}
+
+/*
+ *    Clears a depth buffer to its farthest depth.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_clear(depthbuffer_t *db) {
+    u64   i     = 0;
+    u64   count = (u64)db->width * db->height;
+    u64   bytes = count * (db->fmt == DEPTH_FMT_UNORM16 ? sizeof(u16) : sizeof(u32));
+    char *buf   = (char *)db->buf;
+
+    depthbuffer_begin_clear(db);
+
+#if defined(DEPTH_AVX2)
+    __m256i v = db->fmt == DEPTH_FMT_UNORM16 ? _mm256_set1_epi16((short)db->clear) : _mm256_set1_epi32((int)db->clear);
+
+    for (; i + 32 <= bytes; i += 32) {
+        _mm256_storeu_si256((__m256i *)(buf + i), v);
+    }
+#elif defined(DEPTH_SSE2)
+    __m128i v = db->fmt == DEPTH_FMT_UNORM16 ? _mm_set1_epi16((short)db->clear) : _mm_set1_epi32((int)db->clear);
+
+    for (; i + 64 <= bytes; i += 64) {
+        _mm_storeu_si128((__m128i *)(buf + i +  0), v);
+        _mm_storeu_si128((__m128i *)(buf + i + 16), v);
+        _mm_storeu_si128((__m128i *)(buf + i + 32), v);
+        _mm_storeu_si128((__m128i *)(buf + i + 48), v);
+    }
+#endif
+
+    /*
+     *    Whatever the vector loop left over, or everything without one.
+     */
+    if (db->fmt == DEPTH_FMT_UNORM16) {
+        for (i /= sizeof(u16); i < count; i++) {
+            ((u16 *)db->buf)[i] = (u16)db->clear;
+        }
+    } else {
+        for (i /= sizeof(u32); i < count; i++) {
+            ((u32 *)db->buf)[i] = db->clear;
+        }
+    }
+}
+
+/*
+ *    Clears a rectangle of a depth buffer to the value worked out by
+ *    the last clear.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param u32 x0               The left of the rectangle.
+ *    @param u32 y0               The top of the rectangle.
+ *    @param u32 x1               One past the right of the rectangle.
+ *    @param u32 y1               One past the bottom of the rectangle.
+ */
+void depthbuffer_clear_rect(depthbuffer_t *db, u32 x0, u32 y0, u32 x1, u32 y1) {
+    u32 x;
+    u32 y;
+
+    for (y = y0; y < y1; y++) {
+        if (db->fmt == DEPTH_FMT_UNORM16) {
+            u16 *row = (u16 *)db->buf + y * db->width;
+
+            for (x = x0; x < x1; x++) {
+                row[x] = (u16)db->clear;
+            }
+        } else {
+            u32 *row = (u32 *)db->buf + y * db->width;
+
+            for (x = x0; x < x1; x++) {
+                row[x] = db->clear;
+            }
+        }
+    }
+}
+
+/*
+ *    Frees a depth buffer.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_free(depthbuffer_t *db) {
+    if (db == (depthbuffer_t *)0x0)
+        return;
+
+    free(db->buf);
+    free(db);
+}
@@ -0,0 +1,153 @@
+/*
+ *    depth.h    --    header for depth buffers
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    A depth buffer holds the view depth of the nearest surface drawn
+ *    to each pixel, at one of a few precisions. Depths are compared as
+ *    encoded integers, which for 32 bit floats are just their bits,
+ *    since positive floats sort the same as their bits. The unorm
+ *    formats store depth linearly over the range up to the far plane,
+ *    trading precision for bandwidth.
+ */
+#ifndef CHIK_GFX_DEPTH_H
+#define CHIK_GFX_DEPTH_H
+
+#include "libchik.h"
+
+#include <string.h>
+
+#define DEPTH_CLEAR 1000.f
+
+typedef enum {
+    DEPTH_FMT_F32,
+    DEPTH_FMT_UNORM24,
+    DEPTH_FMT_UNORM16,
+} depth_fmt_e;
+
+typedef struct {
+    u32         width;
+    u32         height;
+    depth_fmt_e fmt;
+    float       scale;
+    u32         clear;
+    void       *buf;
+} depthbuffer_t;
+
+/*
+ *    Creates a depth buffer.
+ *
+ *    @param u32 width          The width of the depth buffer.
+ *    @param u32 height         The height of the depth buffer.
+ *    @param depth_fmt_e fmt    The format of the depth buffer.
+ *
+ *    @return depthbuffer_t *   The depth buffer, or NULL on failure.
+ */
+depthbuffer_t *depthbuffer_create(u32 width, u32 height, depth_fmt_e fmt);
+
+/*
+ *    Clears a depth buffer to its farthest depth.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_clear(depthbuffer_t *db);
+
+/*
+ *    Works out the value a depth buffer clears to, without clearing
+ *    it, for clears that are filled in later a piece at a time.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_begin_clear(depthbuffer_t *db);
+
+/*
+ *    Clears a rectangle of a depth buffer to the value worked out by
+ *    the last clear.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param u32 x0               The left of the rectangle.
+ *    @param u32 y0               The top of the rectangle.
+ *    @param u32 x1               One past the right of the rectangle.
+ *    @param u32 y1               One past the bottom of the rectangle.
+ */
+void depthbuffer_clear_rect(depthbuffer_t *db, u32 x0, u32 y0, u32 x1, u32 y1);
+
+/*
+ *    Frees a depth buffer.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ */
+void depthbuffer_free(depthbuffer_t *db);
+
+/*
+ *    Encodes a depth for comparing against, and storing in, a depth
+ *    buffer. Nearer depths encode to smaller values.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param float z              The depth.
+ *
+ *    @return u32                 The encoded depth.
+ */
+static inline u32 depth_encode(depthbuffer_t *db, float z) {
+    u32 bits;
+
+    if (db->fmt == DEPTH_FMT_F32) {
+        memcpy(&bits, &z, sizeof(bits));
+        return bits;
+    }
+
+    z *= db->scale;
+
+    return z < (float)db->clear ? (u32)MAX(z, 0.f) : db->clear;
+}
+
+/*
+ *    Decodes a depth from a depth buffer. Unorm depths decode to the
+ *    nearest depth that encodes to them.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param u32 v                The encoded depth.
+ *
+ *    @return float               The depth.
+ */
+static inline float depth_decode(depthbuffer_t *db, u32 v) {
+    float z;
+
+    if (db->fmt == DEPTH_FMT_F32) {
+        memcpy(&z, &v, sizeof(z));
+        return z;
+    }
+
+    return v / db->scale;
+}
+
+/*
+ *    Loads an encoded depth from a depth buffer.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param u32 i                The index of the pixel.
+ *
+ *    @return u32                 The encoded depth.
+ */
+static inline u32 depth_load(depthbuffer_t *db, u32 i) {
+    if (db->fmt == DEPTH_FMT_UNORM16)
+        return ((u16 *)db->buf)[i];
+
+    return ((u32 *)db->buf)[i];
+}
+
+/*
+ *    Stores an encoded depth in a depth buffer.
+ *
+ *    @param depthbuffer_t *db    The depth buffer.
+ *    @param u32 i                The index of the pixel.
+ *    @param u32 v                The encoded depth.
+ */
+static inline void depth_store(depthbuffer_t *db, u32 i, u32 v) {
+    if (db->fmt == DEPTH_FMT_UNORM16)
+        ((u16 *)db->buf)[i] = (u16)v;
+    else
+        ((u32 *)db->buf)[i] = v;
+}
+
+#endif /* CHIK_GFX_DEPTH_H  */
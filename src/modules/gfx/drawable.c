@@ -9,15 +9,126 @@
  */
 #include "drawable.h"
 
+#include <math.h>
 #include <string.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "gfx.h"
 
+#include "arena.h"
+#include "bin.h"
 #include "camera.h"
 #include "cull.h"
+#include "hiz.h"
+#include "occlusion.h"
 #include "raster.h"
 #include "vertexasm.h"
 
+bool _specialized_layouts = false;
+
+/*
+ *    Draws everything still waiting to be drawn, and waits until no
+ *    triangle refers to a mesh, surface, or buffer any more, before one
+ *    is freed or changed. Pipelined frames draw from copies instead,
+ *    so their bins are left alone.
+ */
+static void mesh_retire_draws(void) {
+    mesh_flush();
+
+    if (!_frame_pipelined)
+        bin_flush();
+}
+
+/*
+ *    Finds the offset of the position attribute in a vertex layout.
+ *
+ *    @param v_layout_t *layout    The layout.
+ *
+ *    @return int                  The offset, or -1 if there is none.
+ */
+int vbuffer_position_offset(v_layout_t *layout) {
+    for (u32 i = 0; i < layout->count; i++) {
+        if (layout->attributes[i].usage == V_POS)
+            return layout->attributes[i].offset;
+    }
+
+    return -1;
+}
+
+/*
+ *    Grows bounds to hold a vertex of a vertex buffer.
+ *
+ *    @param mesh_bounds_t *bounds    The bounds.
+ *    @param vbuffer_t     *buf       The vertex buffer.
+ *    @param u32            idx       The index of the vertex.
+ */
+void mesh_bounds_add(mesh_bounds_t *bounds, vbuffer_t *buf, u32 idx) {
+    vec3_t *p = (vec3_t *)(buf->buf + idx * buf->stride + buf->pos_offset);
+
+    if (bounds->radius < 0.f) {
+        bounds->min    = *p;
+        bounds->max    = *p;
+        bounds->radius = 0.f;
+        return;
+    }
+
+    bounds->min.x = MIN(bounds->min.x, p->x);
+    bounds->min.y = MIN(bounds->min.y, p->y);
+    bounds->min.z = MIN(bounds->min.z, p->z);
+    bounds->max.x = MAX(bounds->max.x, p->x);
+    bounds->max.y = MAX(bounds->max.y, p->y);
+    bounds->max.z = MAX(bounds->max.z, p->z);
+}
+
+/*
+ *    Grows bounds to hold other bounds.
+ *
+ *    @param mesh_bounds_t *bounds    The bounds.
+ *    @param mesh_bounds_t *other     The bounds to hold.
+ */
+void mesh_bounds_merge(mesh_bounds_t *bounds, mesh_bounds_t *other) {
+    if (other->radius < 0.f)
+        return;
+
+    if (bounds->radius < 0.f) {
+        *bounds = *other;
+        return;
+    }
+
+    bounds->min.x = MIN(bounds->min.x, other->min.x);
+    bounds->min.y = MIN(bounds->min.y, other->min.y);
+    bounds->min.z = MIN(bounds->min.z, other->min.z);
+    bounds->max.x = MAX(bounds->max.x, other->max.x);
+    bounds->max.y = MAX(bounds->max.y, other->max.y);
+    bounds->max.z = MAX(bounds->max.z, other->max.z);
+}
+
+/*
+ *    Works out the sphere of bounds once the box is done, as the
+ *    sphere around the box.
+ *
+ *    @param mesh_bounds_t *bounds    The bounds.
+ */
+void mesh_bounds_finish(mesh_bounds_t *bounds) {
+    vec3_t half;
+
+    if (bounds->radius < 0.f)
+        return;
+
+    bounds->center.x = (bounds->min.x + bounds->max.x) * 0.5f;
+    bounds->center.y = (bounds->min.y + bounds->max.y) * 0.5f;
+    bounds->center.z = (bounds->min.z + bounds->max.z) * 0.5f;
+
+    half.x = bounds->max.x - bounds->center.x;
+    half.y = bounds->max.y - bounds->center.y;
+    half.z = bounds->max.z - bounds->center.z;
+
+    bounds->radius = sqrtf(half.x * half.x + half.y * half.y + half.z * half.z);
+}
+
 /*
  *    Creates a vertex buffer.
  *
@@ -51,10 +162,12 @@ void *vbuffer_create(void *v, unsigned int size, unsigned int stride, v_layout_t
         return (void *)0x0;
     }
 
-    buf->buf    = malloc(size);
-    buf->size   = size;
-    buf->stride = stride;
-    buf->layout = layout;
+    buf->buf         = malloc(size);
+    buf->size        = size;
+    buf->stride      = stride;
+    buf->layout      = layout;
+    buf->cache       = nullptr;
+    buf->cache_stamp = nullptr;
 
     if (buf->buf == (void *)0x0) {
         log_error("Could not allocate vertex buffer.\n");
@@ -63,9 +176,43 @@ void *vbuffer_create(void *v, unsigned int size, unsigned int stride, v_layout_t
 
     memcpy(buf->buf, v, size);
 
+    buf->pos_offset    = vbuffer_position_offset(&buf->layout);
+    buf->bounds.radius = -1.f;
+
+    if (buf->pos_offset >= 0) {
+        for (u32 i = 0; i < size / stride; i++) {
+            mesh_bounds_add(&buf->bounds, buf, i);
+        }
+
+        mesh_bounds_finish(&buf->bounds);
+    }
+
     return (void *)buf;
 }
 
+/*
+ *    Declares that a vertex buffer's v_add and v_scale only add and
+ *    scale every float of a vertex, leaving the position alone when
+ *    scaling. With --specialized-layouts, built in routines for exactly
+ *    its layout then stand in for them.
+ *
+ *    @param void *buf   The vertex buffer.
+ */
+void vbuffer_specialize(void *buf) {
+    vbuffer_t *vbuf = (vbuffer_t *)buf;
+
+    if (vbuf == (vbuffer_t *)0x0) {
+        LOGF_ERR("Vertex buffer is null.\n");
+        return;
+    }
+
+    if (!_specialized_layouts)
+        return;
+
+    if (!vertexasm_register_builtin_kernels(&vbuf->layout))
+        LOGF_NOTE("No specialized routines for vertex buffer's layout.\n");
+}
+
 /*
  *    Frees a vertex buffer.
  *
@@ -84,10 +231,289 @@ void vbuffer_free(void *buf) {
         return;
     }
 
+    mesh_retire_draws();
+
     free(vbuf->buf);
+    free(vbuf->cache);
+    free(vbuf->cache_stamp);
     free(buf);
 }
 
+/*
+ *    Creates an index buffer.
+ *
+ *    @param void *i              The index data, as 32 bit indices.
+ *    @param u32   count          The amount of indices.
+ *
+ *    @return void *              The index buffer.
+ */
+void *ibuffer_create(void *i, u32 count) {
+    ibuffer_t *buf;
+
+    if (i == nullptr) {
+        LOGF_ERR("Index data is null.\n");
+        return (void *)0x0;
+    }
+    if (count == 0) {
+        LOGF_ERR("Index count is zero.\n");
+        return (void *)0x0;
+    }
+
+    buf = (ibuffer_t *)malloc(sizeof(ibuffer_t));
+
+    if (buf == (ibuffer_t *)0x0) {
+        LOGF_ERR("Could not allocate index buffer.\n");
+        return (void *)0x0;
+    }
+
+    buf->buf   = malloc(count * sizeof(u32));
+    buf->count = count;
+
+    if (buf->buf == (u32 *)0x0) {
+        LOGF_ERR("Could not allocate index buffer.\n");
+        free(buf);
+        return (void *)0x0;
+    }
+
+    memcpy(buf->buf, i, count * sizeof(u32));
+
+    return (void *)buf;
+}
+
+/*
+ *    Frees an index buffer.
+ *
+ *    @param void *buf   The index buffer to free.
+ */
+void ibuffer_free(void *buf) {
+    if (buf == (void *)0x0) {
+        LOGF_ERR("Index buffer pointer is null.\n");
+        return;
+    }
+
+    ibuffer_t *ibuf = (ibuffer_t *)buf;
+
+    mesh_retire_draws();
+
+    free(ibuf->buf);
+    free(buf);
+}
+
+/*
+ *    Recomputes the bounds of a mesh surface from the vertices it
+ *    draws.
+ *
+ *    @param mesh_t         *mesh       The mesh.
+ *    @param mesh_surface_t *surface    The surface.
+ */
+void mesh_surface_update_bounds(mesh_t *mesh, mesh_surface_t *surface) {
+    vbuffer_t *buf = mesh->vbuf;
+    u32        verts;
+    u32        end;
+
+    surface->bounds.radius = -1.f;
+
+    if (buf == (vbuffer_t *)0x0 || buf->pos_offset < 0)
+        return;
+
+    verts = buf->size / buf->stride;
+
+    if (mesh->ibuf != (ibuffer_t *)0x0) {
+        end = MIN(surface->offset + surface->size, mesh->ibuf->count);
+
+        for (u32 i = surface->offset; i < end; i++) {
+            if (mesh->ibuf->buf[i] < verts)
+                mesh_bounds_add(&surface->bounds, buf, mesh->ibuf->buf[i]);
+        }
+    } else {
+        end = MIN(surface->offset + surface->size, verts);
+
+        for (u32 i = surface->offset; i < end; i++) {
+            mesh_bounds_add(&surface->bounds, buf, i);
+        }
+    }
+
+    mesh_bounds_finish(&surface->bounds);
+}
+
+/*
+ *    Recomputes the bounds of a mesh from the bounds of its surfaces,
+ *    or its whole vertex buffer if it has none yet.
+ *
+ *    @param mesh_t *mesh    The mesh.
+ */
+void mesh_update_bounds(mesh_t *mesh) {
+    mesh->bounds.radius = -1.f;
+
+    if (mesh->surface_count == 0) {
+        if (mesh->vbuf != (vbuffer_t *)0x0)
+            mesh->bounds = mesh->vbuf->bounds;
+        return;
+    }
+
+    for (u32 i = 0; i < mesh->surface_count; i++) {
+        mesh_bounds_merge(&mesh->bounds, &mesh->surfaces[i].bounds);
+    }
+
+    mesh_bounds_finish(&mesh->bounds);
+}
+
+/*
+ *    Recomputes the bounds of every surface of a mesh, and the mesh.
+ *
+ *    @param mesh_t *mesh    The mesh.
+ */
+void mesh_update_all_bounds(mesh_t *mesh) {
+    for (u32 i = 0; i < mesh->surface_count; i++) {
+        mesh_surface_update_bounds(mesh, &mesh->surfaces[i]);
+    }
+
+    mesh_update_bounds(mesh);
+}
+
+/*
+ *    Runs a position through the vertex shader of a mesh.
+ *
+ *    @param mesh_t        *mesh    The mesh.
+ *    @param unsigned char *in      The vertex to place the position in.
+ *    @param unsigned char *out     The vertex to transform into.
+ *    @param vec3_t         pos     The position.
+ *
+ *    @return vec4_t                The position, in clip space.
+ */
+static vec4_t mesh_bounds_transform(mesh_t *mesh, unsigned char *in, unsigned char *out, vec3_t pos) {
+    vbuffer_t *buf = mesh->vbuf;
+
+    *(vec3_t *)(in + buf->pos_offset) = pos;
+
+    if (buf->layout.v_fun == (void *)0x0)
+        return vertex_get_position(in);
+
+    buf->layout.v_fun(out, in, mesh->assets);
+
+    return vertex_get_position(out);
+}
+
+/*
+ *    Checks whether bounds can be seen, first by running the sphere
+ *    through the vertex shader as a cheap test against the view
+ *    frustum, then the corners of the box, which are also tested
+ *    against the occluders and the hierarchical depth buffer if there
+ *    is one. The vertex shader is expected to transform positions
+ *    affinely, as a model view projection does. The layout must be
+ *    bound.
+ *
+ *    @param mesh_t        *mesh      The mesh.
+ *    @param mesh_bounds_t *bounds    The bounds.
+ *    @param float         *nearest   Set to the nearest depth of the bounds,
+ *                                    or 0 if it is unknown, may be NULL.
+ *
+ *    @return unsigned int            0 if the bounds are hidden, 1 otherwise.
+ */
+unsigned int mesh_bounds_visible(mesh_t *mesh, mesh_bounds_t *bounds, float *nearest) {
+    vbuffer_t    *buf  = mesh->vbuf;
+    unsigned int  all  = CULL_FRUSTUM_MASK;
+    unsigned int  any  = 0;
+    unsigned char in[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char out[VERTEX_ASM_MAX_VERTEX_SIZE];
+    vec3_t        p;
+    vec4_t        c[8];
+    vec4_t        axes[3];
+    raster_rect_t rect;
+    raster_rect_t target;
+    float         depth;
+
+    if (nearest != (float *)0x0)
+        *nearest = 0.f;
+
+    if (bounds->radius < 0.f || buf->pos_offset < 0)
+        return 1;
+
+    /*
+     *    The first vertex stands in for the attributes the shader may
+     *    read besides the position.
+     */
+    memcpy(in, buf->buf, buf->stride);
+    memcpy(out, buf->buf, buf->stride);
+
+    /*
+     *    The center and the ends of three radii are four vertices to
+     *    the corners' eight, and reject most of what is off-screen.
+     */
+    c[0] = mesh_bounds_transform(mesh, in, out, bounds->center);
+
+    for (u32 i = 0; i < 3; i++) {
+        p = bounds->center;
+
+        p.x += (i == 0) ? bounds->radius : 0.f;
+        p.y += (i == 1) ? bounds->radius : 0.f;
+        p.z += (i == 2) ? bounds->radius : 0.f;
+
+        axes[i]    = mesh_bounds_transform(mesh, in, out, p);
+        axes[i].x -= c[0].x;
+        axes[i].y -= c[0].y;
+        axes[i].z -= c[0].z;
+        axes[i].w -= c[0].w;
+    }
+
+    if (cull_sphere_outcode(c[0], axes) & CULL_FRUSTUM_MASK)
+        return 0;
+
+    for (u32 i = 0; i < 8; i++) {
+        p.x = (i & 1) ? bounds->max.x : bounds->min.x;
+        p.y = (i & 2) ? bounds->max.y : bounds->min.y;
+        p.z = (i & 4) ? bounds->max.z : bounds->min.z;
+
+        c[i] = mesh_bounds_transform(mesh, in, out, p);
+
+        all &= cull_position_outcode(c[i]);
+        any |= cull_position_outcode(c[i]);
+    }
+
+    if (nearest != (float *)0x0) {
+        *nearest = c[0].z;
+
+        for (u32 i = 1; i < 8; i++) {
+            *nearest = MIN(*nearest, c[i].z);
+        }
+    }
+
+    if (all & CULL_FRUSTUM_MASK)
+        return 0;
+
+    if (occlusion_box_occluded(c))
+        return 0;
+
+    /*
+     *    Boxes reaching behind the near plane cover the screen in ways
+     *    that are not worth working out.
+     */
+    if (!_hiz.enabled || (any & (1 << CULL_PLANE_NEAR)))
+        return 1;
+
+    target = raster_get_target_rect();
+    rect   = (raster_rect_t){target.x1, target.y1, 0, 0};
+    depth  = c[0].z;
+
+    for (u32 i = 0; i < 8; i++) {
+        if (c[i].w <= 0.f)
+            return 1;
+
+        rect.x0 = MIN(rect.x0, (int)floorf((c[i].x / c[i].w + 1.0f) * target.x1 / 2));
+        rect.y0 = MIN(rect.y0, (int)floorf((c[i].y / c[i].w + 1.0f) * target.y1 / 2));
+        rect.x1 = MAX(rect.x1, (int)ceilf((c[i].x / c[i].w + 1.0f) * target.x1 / 2) + 1);
+        rect.y1 = MAX(rect.y1, (int)ceilf((c[i].y / c[i].w + 1.0f) * target.y1 / 2) + 1);
+        depth   = MIN(depth, c[i].z);
+    }
+
+    rect.x0 = MAX(rect.x0, target.x0);
+    rect.y0 = MAX(rect.y0, target.y0);
+    rect.x1 = MIN(rect.x1, target.x1);
+    rect.y1 = MIN(rect.y1, target.y1);
+
+    return !hiz_rect_occluded(&rect, depth);
+}
+
 /*
  *    Creates a mesh.
  *
@@ -107,6 +533,7 @@ void *mesh_create(void *v) {
     memset(mesh, 0, sizeof(mesh_t));
 
     mesh->vbuf         = (vbuffer_t *)v;
+    mesh->bounds       = mesh->vbuf ? mesh->vbuf->bounds : (mesh_bounds_t){.radius = -1.f};
     mesh->assets       = (void *)0x0;
     mesh->assets_size  = CHIK_GFX_DRAWABLE_MESH_MAX_ASSETS * 8;
     mesh->assets_count = 0;
@@ -130,8 +557,33 @@ void mesh_set_vbuffer(void *m, void *v) {
         return;
     }
 
+    mesh_retire_draws();
+
     mesh_t *mesh = (mesh_t *)m;
     mesh->vbuf   = (vbuffer_t *)v;
+
+    mesh_update_all_bounds(mesh);
+}
+
+/*
+ *    Sets the index buffer of a mesh. Surfaces of an indexed mesh
+ *    refer to ranges of indices instead of vertices.
+ *
+ *    @param void *m    The mesh.
+ *    @param void *i    The index buffer, or NULL to draw unindexed.
+ */
+void mesh_set_ibuffer(void *m, void *i) {
+    if (m == (void *)0x0) {
+        LOGF_ERR("Mesh is null.\n");
+        return;
+    }
+
+    mesh_retire_draws();
+
+    mesh_t *mesh = (mesh_t *)m;
+    mesh->ibuf   = (ibuffer_t *)i;
+
+    mesh_update_all_bounds(mesh);
 }
 
 /*
@@ -253,6 +705,8 @@ bool mesh_set_surface_count(void* m, u32 count) {
 
     u32 old_count = mesh->surface_count;
 
+    mesh_retire_draws();
+
     void* surfaces = realloc( mesh->surfaces, sizeof( mesh_surface_t ) * count );
 
     if (surfaces == CH_NULL) {
@@ -266,8 +720,11 @@ bool mesh_set_surface_count(void* m, u32 count) {
     // zero out memory of new surfaces
     for (u32 i = old_count; i < mesh->surface_count; i++) {
         memset(&mesh->surfaces[i], 0, sizeof(mesh_surface_t));
+        mesh->surfaces[i].bounds.radius = -1.f;
     }
 
+    mesh_update_bounds(mesh);
+
     return true;
 }
 
@@ -292,13 +749,42 @@ void mesh_set_surface_buffer_data(void* m, u32 surface, u32 offset, u32 size) {
         return;
     }
 
-    if (surface > mesh->surface_count) {
+    if (surface >= mesh->surface_count) {
         VLOGF_ERR("Mesh does not have %d surfaces, only %d\n", surface, mesh->surface_count);
         return;
     }
 
+    mesh_retire_draws();
+
     mesh->surfaces[surface].offset = offset;
     mesh->surfaces[surface].size   = size;
+
+    mesh_surface_update_bounds(mesh, &mesh->surfaces[surface]);
+    mesh_update_bounds(mesh);
+}
+
+/*
+ *    Sets which faces of a mesh surface are culled. Surfaces start out
+ *    with no face culling.
+ *
+ *    @param void *m              The mesh.
+ *    @param u32                  The surface to set the cull mode of
+ *    @param cull_face_e          The faces to cull
+ */
+void mesh_set_surface_cull_mode(void* m, u32 surface, cull_face_e mode) {
+    if (m == (void*)0x0) {
+        LOGF_ERR("Mesh is null.\n");
+        return;
+    }
+
+    mesh_t* mesh = (mesh_t*)m;
+
+    if (surface >= mesh->surface_count || mesh->surfaces == 0x0) {
+        VLOGF_ERR("Mesh does not have %d surfaces, only %d\n", surface, mesh->surface_count);
+        return;
+    }
+
+    mesh->surfaces[surface].cull_mode = mode;
 }
 
 /*
@@ -331,27 +817,446 @@ material_t* mesh_get_material(void* m, u32 surface) {
 }
 
 /*
- *    Rasterizes a mesh multithreaded
+ *    Rasterizes a triangle on the calling thread.
  *
- *    @param void *m    The mesh.
- *    @param     The mesh.
+ *    @param triangle_t *tri    The triangle.
  */
+void mesh_surface_raster_serial(triangle_t *tri) {
+    raster_rasterize_triangle(tri->v0, tri->v1, tri->v2, tri->assets, tri->material);
+}
+
+arena_t           _tri_arena      = {0};
+triangle_batch_t *_tri_batch      = nullptr;
+u32               _tri_batch_size = CHIK_GFX_DRAWABLE_BATCH_SIZE;
+u32               _tri_batch_hint = CHIK_GFX_DRAWABLE_BATCH_SIZE;
 
-void mesh_surface_raster_threaded(unsigned char* a0, unsigned char* b0, unsigned char* c0, char* assets, material_t* material) {
-    triangle_t* pTri = (triangle_t*)malloc(sizeof(triangle_t));
-    pTri->v0 = malloc(VERTEX_ASM_MAX_VERTEX_SIZE);
-    pTri->v1 = malloc(VERTEX_ASM_MAX_VERTEX_SIZE);
-    pTri->v2 = malloc(VERTEX_ASM_MAX_VERTEX_SIZE);
-    pTri->assets = assets;
-    pTri->material = material;
+/*
+ *    Hands the batch being filled to the threadpool.
+ */
+void mesh_submit_batch(void) {
+    if (_tri_batch == (triangle_batch_t*)0x0)
+        return;
 
-    memcpy(pTri->v0, a0, VERTEX_ASM_MAX_VERTEX_SIZE);
-    memcpy(pTri->v1, b0, VERTEX_ASM_MAX_VERTEX_SIZE);
-    memcpy(pTri->v2, c0, VERTEX_ASM_MAX_VERTEX_SIZE);
-    threadpool_submit(raster_rasterize_triangle_thread, (void*)pTri);
+    threadpool_submit(raster_rasterize_batch_thread, (void*)_tri_batch);
+    _tri_batch = nullptr;
 }
 
-char* (*mesh_surface_raster_func)(unsigned char*, unsigned char*, unsigned char*, char* assets, material_t* material) = 0;
+/*
+ *    Rasterizes a triangle multithreaded
+ *
+ *    The triangle is copied into the frame's arena, with only as many
+ *    bytes as the layout's stride per vertex, and is queued up in a
+ *    batch which is submitted to the threadpool once it is full. When
+ *    batching by surface, the batch is sized for the whole surface and
+ *    submitted once the surface is done.
+ *
+ *    @param triangle_t *tri    The triangle.
+ */
+void mesh_surface_raster_threaded(triangle_t *tri) {
+    triangle_t*  pTri;
+    char*        verts;
+    unsigned int stride = tri->layout->stride;
+
+    if (_tri_batch == (triangle_batch_t*)0x0) {
+        _tri_batch = arena_alloc(&_tri_arena, sizeof(triangle_batch_t));
+
+        if (_tri_batch == (triangle_batch_t*)0x0) {
+            LOGF_ERR("Could not allocate triangle batch.\n");
+            return;
+        }
+
+        _tri_batch->capacity = _tri_batch_size ? _tri_batch_size : _tri_batch_hint;
+        _tri_batch->tris     = arena_alloc(&_tri_arena, sizeof(triangle_t) * _tri_batch->capacity);
+        _tri_batch->count    = 0;
+
+        if (_tri_batch->tris == (triangle_t*)0x0) {
+            LOGF_ERR("Could not allocate triangle batch.\n");
+            _tri_batch = nullptr;
+            return;
+        }
+    }
+
+    verts = arena_alloc(&_tri_arena, 3 * stride);
+
+    if (verts == (char*)0x0) {
+        LOGF_ERR("Could not allocate triangle vertices.\n");
+        return;
+    }
+
+    memcpy(verts + 0 * stride, tri->v0, stride);
+    memcpy(verts + 1 * stride, tri->v1, stride);
+    memcpy(verts + 2 * stride, tri->v2, stride);
+
+    pTri = &_tri_batch->tris[_tri_batch->count++];
+    pTri->v0 = verts + 0 * stride;
+    pTri->v1 = verts + 1 * stride;
+    pTri->v2 = verts + 2 * stride;
+    pTri->assets = tri->assets;
+    pTri->material = tri->material;
+    pTri->layout = tri->layout;
+
+    if (_tri_batch->count == _tri_batch->capacity)
+        mesh_submit_batch();
+}
+
+void (*mesh_surface_raster_func)(triangle_t *tri) = 0;
+
+/*
+ *    Copies of the material and layout to hand triangles instead of
+ *    the mesh's own, while a pipelined frame is drawing its surfaces.
+ */
+material_t *_draw_material = nullptr;
+v_layout_t *_draw_layout   = nullptr;
+
+/*
+ *    Scratch for clipping, per thread, grown to fit the largest stride
+ *    clipped on the thread, rather than the largest stride there is.
+ */
+THREAD_LOCAL unsigned char *_clip_scratch      = nullptr;
+THREAD_LOCAL u32            _clip_scratch_size = 0;
+
+/*
+ *    Returns this thread's clipping scratch, grown for a stride.
+ *
+ *    @param u32 stride           The size of a vertex.
+ *
+ *    @return unsigned char *     The scratch, or NULL on failure.
+ */
+static unsigned char *mesh_clip_scratch(u32 stride) {
+    unsigned char *scratch;
+    u32            size = CULL_CLIP_SCRATCH_SIZE(stride);
+
+    if (size <= _clip_scratch_size)
+        return _clip_scratch;
+
+    scratch = realloc(_clip_scratch, size);
+
+    if (scratch == (unsigned char *)0x0) {
+        LOGF_ERR("Could not grow clipping scratch.\n");
+        return nullptr;
+    }
+
+    _clip_scratch      = scratch;
+    _clip_scratch_size = size;
+
+    return scratch;
+}
+
+/*
+ *    Clips and rasterizes a triangle of transformed vertices.
+ *
+ *    @param mesh_t         *mesh       The mesh.
+ *    @param mesh_surface_t *surface    The surface.
+ *    @param void           *a          The first transformed vertex.
+ *    @param void           *b          The second transformed vertex.
+ *    @param void           *c          The third transformed vertex.
+ */
+void mesh_surface_draw_triangle(mesh_t* mesh, mesh_surface_t* surface, void* a, void* b, void* c) {
+    vbuffer_t*     buf  = mesh->vbuf;
+    triangle_t     tri;
+    unsigned char* clip = mesh_clip_scratch(buf->stride);
+    int            clipped_vertices;
+
+    if (clip == (unsigned char*)0x0)
+        return;
+
+    /*
+     *    If the vertex is outside of the view frustum, use
+     *    linear interpolation to find the point on the triangle
+     *    that is inside the view frustum.
+     */
+    clipped_vertices = cull_clip_triangle(a, b, c, clip, buf->stride);
+
+    for (long j = 0; j < clipped_vertices; ++j) {
+        vertex_perspective_divide(clip + j * buf->stride);
+    }
+
+    tri.assets   = mesh->assets;
+    tri.material = _draw_material ? _draw_material : &surface->material;
+    tri.layout   = _draw_layout ? _draw_layout : &buf->layout;
+
+    /*
+     *    Draw the clipped polygon as a fan.
+     */
+    for (long j = 0; j < clipped_vertices - 2; ++j) {
+        tri.v0 = clip + (0 + 0) * buf->stride;
+        tri.v1 = clip + (j + 1) * buf->stride;
+        tri.v2 = clip + (j + 2) * buf->stride;
+
+        if (cull_projected_triangle(tri.v0, tri.v1, tri.v2, surface->cull_mode))
+            continue;
+
+        mesh_surface_raster_func(&tri);
+    }
+}
+
+u32  _draw_id         = 0;
+bool _parallel_vertex = false;
+
+/*
+ *    Allocates the post-transform buffer of a vertex buffer, the
+ *    first time it is drawn.
+ *
+ *    @param vbuffer_t *buf    The vertex buffer.
+ *
+ *    @return unsigned int     1 on success, 0 on failure.
+ */
+unsigned int vbuffer_alloc_cache(vbuffer_t* buf) {
+    if (buf->cache != (char*)0x0)
+        return 1;
+
+    buf->cache       = malloc(buf->size);
+    buf->cache_stamp = calloc(buf->size / buf->stride, sizeof(u32));
+
+    if (buf->cache == (char*)0x0 || buf->cache_stamp == (u32*)0x0) {
+        LOGF_ERR("Could not allocate vertex transform cache, shading without it.\n");
+        free(buf->cache);
+        free(buf->cache_stamp);
+        buf->cache       = nullptr;
+        buf->cache_stamp = nullptr;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ *    Returns a vertex of a mesh after the vertex shader, shading it
+ *    only the first time it is asked for during the current draw.
+ *
+ *    @param mesh_t *mesh    The mesh.
+ *    @param u32     idx     The index of the vertex.
+ *
+ *    @return void *         The transformed vertex, or NULL if out of range.
+ */
+void* mesh_transform_vertex(mesh_t* mesh, u32 idx) {
+    vbuffer_t* buf = mesh->vbuf;
+    char*      out;
+
+    if (idx >= buf->size / buf->stride) {
+        return (void*)0x0;
+    }
+
+    out = buf->cache + idx * buf->stride;
+
+    if (buf->cache_stamp[idx] == _draw_id) {
+        return out;
+    }
+
+    memcpy(out, buf->buf + idx * buf->stride, buf->stride);
+
+    if (buf->layout.v_fun != (void*)0x0) {
+        buf->layout.v_fun(out, buf->buf + idx * buf->stride, mesh->assets);
+    }
+
+    buf->cache_stamp[idx] = _draw_id;
+
+    return out;
+}
+
+#ifdef _MSC_VER
+    #define DRAWABLE_ATOMIC_ADD(p, v) ((u32)_InterlockedExchangeAdd((volatile long *)(p), (long)(v)) + (u32)(v))
+    #define DRAWABLE_ATOMIC_LOAD(p)   ((u32)_InterlockedOr((volatile long *)(p), 0))
+#else
+    #define DRAWABLE_ATOMIC_ADD(p, v) __atomic_add_fetch((p), (u32)(v), __ATOMIC_ACQ_REL)
+    #define DRAWABLE_ATOMIC_LOAD(p)   __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+/*
+ *    A range of vertices being shaded in chunks, which workers and the
+ *    caller claim one at a time. The last one holding the job frees
+ *    it, as a worker may only get to it after the caller has moved on.
+ */
+typedef struct {
+    mesh_t* mesh;
+    u32     start;
+    u32     end;
+    u32     size;
+    u32     count;
+    u32     next;
+    u32     done;
+    u32     refs;
+} vertex_shade_t;
+
+/*
+ *    Shades chunks of a job until none are left to claim.
+ *
+ *    @param vertex_shade_t *job     The job.
+ *    @param unsigned int    bind    Whether to bind the mesh's layout
+ *                                   before shading the first chunk.
+ */
+static void mesh_shade_claim(vertex_shade_t* job, unsigned int bind) {
+    u32 chunk;
+    u32 first;
+    u32 last;
+
+    /*
+     *    Nothing of the job but its counters may be touched until a
+     *    chunk is claimed, since the caller only waits for claimed ones.
+     */
+    while ((chunk = DRAWABLE_ATOMIC_ADD(&job->next, 1) - 1) < job->count) {
+        if (bind) {
+            vertexasm_bind_layout(&job->mesh->vbuf->layout);
+            bind = 0;
+        }
+
+        first = job->start + chunk * job->size;
+        last  = MIN(first + job->size, job->end);
+
+        for (u32 i = first; i < last; i++) {
+            mesh_transform_vertex(job->mesh, i);
+        }
+
+        DRAWABLE_ATOMIC_ADD(&job->done, 1);
+    }
+}
+
+/*
+ *    Lets go of a job, freeing it if nothing else holds it.
+ *
+ *    @param vertex_shade_t *job    The job.
+ */
+static void mesh_shade_release(vertex_shade_t* job) {
+    if (DRAWABLE_ATOMIC_ADD(&job->refs, -1) == 0)
+        free(job);
+}
+
+/*
+ *    Shades chunks of vertices into the post-transform buffer.
+ *
+ *    @param void *args    The vertex_shade_t to shade.
+ *
+ *    @return void *       NULL.
+ */
+void* mesh_shade_chunk_thread(void* args) {
+    vertex_shade_t* job = (vertex_shade_t*)args;
+
+    mesh_shade_claim(job, 1);
+    mesh_shade_release(job);
+
+    return nullptr;
+}
+
+/*
+ *    Shades a range of vertices into the post-transform buffer, in
+ *    chunks across the threadpool if parallel shading is enabled and
+ *    the range is large enough to be worth it. The caller shades
+ *    chunks as well, and only waits for chunks that workers have
+ *    started, never for other work queued on the threadpool.
+ *
+ *    @param mesh_t *mesh     The mesh.
+ *    @param u32     start    The first vertex.
+ *    @param u32     end      One past the last vertex.
+ */
+void mesh_shade_vertices(mesh_t* mesh, u32 start, u32 end) {
+    vertex_shade_t* job;
+
+    if (!_parallel_vertex || end - start < 2 * CHIK_GFX_DRAWABLE_VERTEX_CHUNK ||
+        (job = malloc(sizeof(vertex_shade_t))) == (vertex_shade_t*)0x0) {
+        for (u32 i = start; i < end; i++) {
+            mesh_transform_vertex(mesh, i);
+        }
+        return;
+    }
+
+    job->mesh  = mesh;
+    job->start = start;
+    job->end   = end;
+    job->size  = MAX(CHIK_GFX_DRAWABLE_VERTEX_CHUNK,
+                     (end - start + CHIK_GFX_DRAWABLE_VERTEX_MAX_CHUNKS - 1) / CHIK_GFX_DRAWABLE_VERTEX_MAX_CHUNKS);
+    job->count = (end - start + job->size - 1) / job->size;
+    job->next  = 0;
+    job->done  = 0;
+    job->refs  = job->count;
+
+    for (u32 i = 1; i < job->count; i++) {
+        threadpool_submit(mesh_shade_chunk_thread, job);
+    }
+
+    mesh_shade_claim(job, 0);
+
+    /*
+     *    Every chunk is claimed by now, and the ones workers claimed
+     *    are being shaded, so this is a short wait.
+     */
+    while (DRAWABLE_ATOMIC_LOAD(&job->done) < job->count)
+        ;
+
+    mesh_shade_release(job);
+}
+
+/*
+ *    Draws a mesh surface without the post-transform buffer, shading
+ *    each triangle's vertices as it goes, for when the buffer could
+ *    not be allocated.
+ *
+ *    @param mesh_t         *mesh       The mesh.
+ *    @param mesh_surface_t *surface    The surface.
+ */
+static void mesh_surface_draw_uncached(mesh_t* mesh, mesh_surface_t* surface) {
+    vbuffer_t*    buf   = mesh->vbuf;
+    ibuffer_t*    ibuf  = mesh->ibuf;
+    u32           count = buf->size / buf->stride;
+    u32           end   = surface->offset + surface->size;
+    u32           idx;
+    unsigned char v[3][VERTEX_ASM_MAX_VERTEX_SIZE];
+
+    if (ibuf != (ibuffer_t*)0x0)
+        end = MIN(end, ibuf->count);
+    else
+        end = MIN(end, count);
+
+    for (u32 i = surface->offset; i + 2 < end; i += 3) {
+        for (u32 j = 0; j < 3; j++) {
+            idx = ibuf != (ibuffer_t*)0x0 ? ibuf->buf[i + j] : i + j;
+
+            if (idx >= count) {
+                LOGF_ERR("Index out of range of the vertex buffer.\n");
+                return;
+            }
+
+            if (buf->layout.v_fun != (void*)0x0)
+                buf->layout.v_fun(v[j], buf->buf + idx * buf->stride, mesh->assets);
+            else
+                memcpy(v[j], buf->buf + idx * buf->stride, buf->stride);
+        }
+
+        mesh_surface_draw_triangle(mesh, surface, v[0], v[1], v[2]);
+    }
+}
+
+/*
+ *    Draws an indexed mesh surface, where the surface's offset and
+ *    size count indices rather than vertices.
+ *
+ *    @param mesh_t         *mesh       The mesh.
+ *    @param mesh_surface_t *surface    The surface.
+ */
+void mesh_surface_draw_indexed(mesh_t* mesh, mesh_surface_t* surface) {
+    ibuffer_t* ibuf = mesh->ibuf;
+    u32        end  = MIN(surface->offset + surface->size, ibuf->count);
+    void*      a;
+    void*      b;
+    void*      c;
+
+    if (!vbuffer_alloc_cache(mesh->vbuf)) {
+        mesh_surface_draw_uncached(mesh, surface);
+        return;
+    }
+
+    for (u32 i = surface->offset; i + 2 < end; i += 3) {
+        a = mesh_transform_vertex(mesh, ibuf->buf[i + 0]);
+        b = mesh_transform_vertex(mesh, ibuf->buf[i + 1]);
+        c = mesh_transform_vertex(mesh, ibuf->buf[i + 2]);
+
+        if (a == (void*)0x0 || b == (void*)0x0 || c == (void*)0x0) {
+            LOGF_ERR("Index out of range of the vertex buffer.\n");
+            return;
+        }
+
+        mesh_surface_draw_triangle(mesh, surface, a, b, c);
+    }
+}
 
 /*
  *    Draws a mesh surface.
@@ -362,79 +1267,276 @@ char* (*mesh_surface_raster_func)(unsigned char*, unsigned char*, unsigned char*
 void mesh_surface_draw(mesh_t* mesh, mesh_surface_t* surface) {
     vbuffer_t* buf = mesh->vbuf;
 
-    char* buffer = buf->buf + (surface->offset * buf->stride);
-
     unsigned int num_verts = surface->size;
 
     vertexasm_set_layout(buf->layout);
 
-    for (unsigned int i = 0; i < num_verts; i += 3) {
-        unsigned char a0[VERTEX_ASM_MAX_VERTEX_SIZE];
-        unsigned char b0[VERTEX_ASM_MAX_VERTEX_SIZE];
-        unsigned char c0[VERTEX_ASM_MAX_VERTEX_SIZE];
+    /*
+     *    Clipping may add triangles, in which case a surface sized
+     *    batch spills over into another one.
+     */
+    _tri_batch_hint = MAX(num_verts / 3, 1);
 
-        void* a = buffer + (i + 0) * buf->stride;
-        void* b = buffer + (i + 1) * buf->stride;
-        void* c = buffer + (i + 2) * buf->stride;
+    if (mesh->ibuf != (ibuffer_t*)0x0) {
+        mesh_surface_draw_indexed(mesh, surface);
+    } else if (vbuffer_alloc_cache(buf)) {
+        u32 start = MIN(surface->offset, buf->size / buf->stride);
+        u32 end   = MIN(surface->offset + num_verts, buf->size / buf->stride);
 
         /*
-         *    Copy the vertex data into a buffer.
+         *    Shade the surface's vertices in one go, then assemble
+         *    and clip triangles out of the shaded vertices.
          */
-        memcpy(a0, a, buf->stride);
-        memcpy(b0, b, buf->stride);
-        memcpy(c0, c, buf->stride);
+        mesh_shade_vertices(mesh, start, end);
 
-        /*
-         *    Apply the vertex shader.
-         *    TODO: Do this check earlier
-         */
-        if (buf->layout.v_fun != (void*)0x0) {
-            buf->layout.v_fun(a0, a, mesh->assets);
-            buf->layout.v_fun(b0, b, mesh->assets);
-            buf->layout.v_fun(c0, c, mesh->assets);
+        for (u32 i = start; i + 2 < end; i += 3) {
+            mesh_surface_draw_triangle(mesh, surface,
+                buf->cache + (i + 0) * buf->stride,
+                buf->cache + (i + 1) * buf->stride,
+                buf->cache + (i + 2) * buf->stride);
         }
+    } else {
+        mesh_surface_draw_uncached(mesh, surface);
+    }
 
-        /*
-         *    If the vertex is outside of the view frustum, use
-         *    linear interpolation to find the point on the triangle
-         *    that is inside the view frustum.
-         */
-        int clipped_vertices = 0;
+    if (_tri_batch_size == 0)
+        mesh_submit_batch();
+}
+
+
+/*
+ *    A surface drawn while draws are sorted, kept until the end of the
+ *    render group. The mesh's assets are copied, since the game may
+ *    change them before the surface is drawn.
+ */
+typedef struct {
+    u64     key;
+    mesh_t *mesh;
+    u32     surface;
+    u32     draw_id;
+    char   *assets;
+} mesh_draw_item_t;
+
+bool              _draw_sorted        = false;
+mesh_draw_item_t *_draw_items         = nullptr;
+mesh_draw_item_t *_draw_items_swap    = nullptr;
+u32               _draw_item_count    = 0;
+u32               _draw_item_capacity = 0;
+arena_t           _draw_arenas[2]     = {0};
+u32               _draw_arena         = 0;
+
+/*
+ *    Builds the sort key of a surface. Surfaces are sorted by the
+ *    power of two their depth falls in, then by material, so that
+ *    surfaces sharing a texture are drawn together, and then front to
+ *    back, so that the depth test throws away as much as it can.
+ *
+ *    @param material_t *mat      The surface's material.
+ *    @param float       depth    The nearest depth of the surface.
+ *
+ *    @return u64                 The key.
+ */
+static u64 mesh_draw_key(material_t *mat, float depth) {
+    u32 bits;
+    u64 material;
+
+    /*
+     *    Positive floats sort the same as their bits, and the top bits
+     *    hold the exponent.
+     */
+    depth = depth > 0.f ? depth : 0.f;
+    memcpy(&bits, &depth, sizeof(bits));
+
+    material = (((u64)(size_t)mat->albedo >> 4) * 2654435761u >> 8) & 0xffffff;
+
+    return ((u64)(bits >> 23) << 56) | (material << 32) | bits;
+}
+
+/*
+ *    Records a visible surface in the draw list.
+ *
+ *    @param mesh_t *mesh       The mesh.
+ *    @param u32     surface    The surface.
+ *    @param char   *assets     The copy of the mesh's assets.
+ *    @param float   depth      The nearest depth of the surface.
+ */
+static void mesh_record_draw(mesh_t *mesh, u32 surface, char *assets, float depth) {
+    mesh_draw_item_t *items;
+    mesh_draw_item_t *swap;
+    u32               capacity;
+
+    if (_draw_item_count == _draw_item_capacity) {
+        capacity = MAX(_draw_item_capacity * 2, 256);
+        items    = realloc(_draw_items, sizeof(mesh_draw_item_t) * capacity);
+
+        if (items == (mesh_draw_item_t *)0x0) {
+            LOGF_ERR("Could not grow draw list.\n");
+            return;
+        }
+
+        _draw_items = items;
+        swap        = realloc(_draw_items_swap, sizeof(mesh_draw_item_t) * capacity);
+
+        if (swap == (mesh_draw_item_t *)0x0) {
+            LOGF_ERR("Could not grow draw list.\n");
+            return;
+        }
+
+        _draw_items_swap    = swap;
+        _draw_item_capacity = capacity;
+    }
+
+    items          = &_draw_items[_draw_item_count++];
+    items->key     = mesh_draw_key(&mesh->surfaces[surface].material, depth);
+    items->mesh    = mesh;
+    items->surface = surface;
+    items->draw_id = _draw_id;
+    items->assets  = assets;
+}
+
+/*
+ *    Sorts the draw list by key, a byte at a time, skipping the bytes
+ *    every key shares.
+ */
+static void mesh_sort_draws(void) {
+    u32               counts[256];
+    u32               offset;
+    u32               n;
+    u32               byte;
+    mesh_draw_item_t *src = _draw_items;
+    mesh_draw_item_t *dst = _draw_items_swap;
+    mesh_draw_item_t *tmp;
+
+    for (u32 shift = 0; shift < 64; shift += 8) {
+        memset(counts, 0, sizeof(counts));
+
+        for (u32 i = 0; i < _draw_item_count; i++) {
+            counts[(src[i].key >> shift) & 0xff]++;
+        }
+
+        if (counts[(src[0].key >> shift) & 0xff] == _draw_item_count)
+            continue;
+
+        for (offset = 0, byte = 0; byte < 256; byte++) {
+            n             = counts[byte];
+            counts[byte]  = offset;
+            offset       += n;
+        }
+
+        for (u32 i = 0; i < _draw_item_count; i++) {
+            dst[counts[(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    _draw_items      = src;
+    _draw_items_swap = dst;
+}
 
-        unsigned char* new_verts = cull_clip_triangle(a0, b0, c0, &clipped_vertices, 1);
+/*
+ *    Copies the material of a surface and the layout of its mesh into
+ *    the draw arena, for the triangles of a pipelined frame to read
+ *    while the game may already be changing or freeing the originals.
+ *
+ *    @param mesh_t *mesh       The mesh.
+ *    @param u32     surface    The surface.
+ *
+ *    @return unsigned int      1 on success, 0 on failure.
+ */
+static unsigned int mesh_copy_draw_state(mesh_t *mesh, u32 surface) {
+    _draw_material = arena_alloc(&_draw_arenas[_draw_arena], sizeof(material_t));
+    _draw_layout   = arena_alloc(&_draw_arenas[_draw_arena], sizeof(v_layout_t));
+
+    if (_draw_material == (material_t *)0x0 || _draw_layout == (v_layout_t *)0x0) {
+        LOGF_ERR("Could not copy surface material and layout.\n");
+        _draw_material = nullptr;
+        _draw_layout   = nullptr;
+        return 0;
+    }
+
+    *_draw_material = mesh->surfaces[surface].material;
+    *_draw_layout   = mesh->vbuf->layout;
+
+    return 1;
+}
+
+/*
+ *    Sorts the draw list, and draws every surface in it.
+ */
+static void mesh_execute_draws(void) {
+    mesh_draw_item_t *item;
+    mesh_draw_item_t *last    = nullptr;
+    mesh_t           *mesh;
+    char             *assets;
+    u32               draw_id = _draw_id;
+
+    if (_draw_item_count == 0)
+        return;
+
+    mesh_sort_draws();
+
+    /*
+     *    Each surface is drawn with the assets and id of the draw that
+     *    recorded it, so that surfaces of the same draw still share
+     *    transformed vertices.
+     */
+    for (u32 i = 0; i < _draw_item_count; i++) {
+        item   = &_draw_items[i];
+        mesh   = item->mesh;
+        assets = mesh->assets;
 
         /*
-         *    Draw the clipped vertices.
+         *    Sorting keeps a mesh's surfaces together more often than
+         *    not, and those share their copies.
          */
-        for (long j = 0; j < clipped_vertices - 2; ++j) {
-            memcpy(a0, new_verts + (0 + 0) * VERTEX_ASM_MAX_VERTEX_SIZE,
-                buf->stride);
-            memcpy(b0, new_verts + (j + 1) * VERTEX_ASM_MAX_VERTEX_SIZE,
-                buf->stride);
-            memcpy(c0, new_verts + (j + 2) * VERTEX_ASM_MAX_VERTEX_SIZE,
-                buf->stride);
-
-            vertex_perspective_divide(a0);
-            vertex_perspective_divide(b0);
-            vertex_perspective_divide(c0);
-
-            /*
-             *    Draw the triangle.
-             */
-            mesh_surface_raster_func(a0, b0, c0, mesh->assets, &surface->material);
+        if (_frame_pipelined && (last == (mesh_draw_item_t *)0x0 || last->mesh != mesh || last->surface != item->surface)) {
+            if (!mesh_copy_draw_state(mesh, item->surface))
+                continue;
+
+            last = item;
         }
+
+        mesh->assets = item->assets;
+        _draw_id     = item->draw_id;
+
+        vertexasm_set_layout(mesh->vbuf->layout);
+        mesh_surface_draw(mesh, &mesh->surfaces[item->surface]);
+
+        mesh->assets = assets;
     }
-    //threadpool_wait();
-}
 
+    _draw_id         = draw_id;
+    _draw_item_count = 0;
+    _draw_material   = nullptr;
+    _draw_layout     = nullptr;
+
+    /*
+     *    Triangles keep pointers to the assets until the tile bins are
+     *    flushed, which happens after this flush, so the copies are
+     *    recycled at the flush after next. Pipelined frames keep them
+     *    until the frame is finished instead, see mesh_end_frame.
+     */
+    if (_frame_pipelined)
+        return;
+
+    _draw_arena ^= 1;
+    arena_reset(&_draw_arenas[_draw_arena]);
+}
 
 /*
- *    Draws a mesh.
+ *    Draws a mesh. When draws are sorted, the mesh's visible surfaces
+ *    are only recorded, and drawn when the render group is flushed.
  *
  *    @param void *m    The mesh.
  */
 void mesh_draw(void *m) {
-    mesh_t *mesh = (mesh_t *)m;
+    mesh_t *mesh   = (mesh_t *)m;
+    char   *assets = (char *)0x0;
+    float   depth;
+    float   surface_depth;
 
     if (mesh == (mesh_t *)0x0) {
         LOGF_ERR("Mesh is null.\n");
@@ -451,8 +1553,47 @@ void mesh_draw(void *m) {
         return;
     }
 
+    /*
+     *    Every draw gets a new id, so that transformed vertices cached
+     *    by an earlier draw, possibly with other assets, are redone.
+     */
+    if (++_draw_id == 0)
+        _draw_id = 1;
+
+    /*
+     *    Skip meshes, and then surfaces, that are entirely out of view
+     *    before any of their vertices are touched.
+     */
+    vertexasm_set_layout(mesh->vbuf->layout);
+
+    if (!mesh_bounds_visible(mesh, &mesh->bounds, &depth))
+        return;
+
+    if (_draw_sorted) {
+        assets = mesh->assets;
+
+        if (assets != (char *)0x0) {
+            assets = arena_alloc(&_draw_arenas[_draw_arena], mesh->assets_size + 8 * CHIK_GFX_DRAWABLE_MESH_MAX_ASSETS);
+
+            if (assets == (char *)0x0) {
+                LOGF_ERR("Could not copy mesh assets.\n");
+                return;
+            }
+
+            memcpy(assets, mesh->assets, mesh->assets_size + 8 * CHIK_GFX_DRAWABLE_MESH_MAX_ASSETS);
+        }
+    }
+
     for ( u32 i = 0; i < mesh->surface_count; i++ ) {
-        mesh_surface_draw(mesh, &mesh->surfaces[i]);
+        surface_depth = depth;
+
+        if (mesh->surface_count > 1 && !mesh_bounds_visible(mesh, &mesh->surfaces[i].bounds, &surface_depth))
+            continue;
+
+        if (_draw_sorted)
+            mesh_record_draw(mesh, i, assets, surface_depth);
+        else
+            mesh_surface_draw(mesh, &mesh->surfaces[i]);
     }
 }
 
@@ -467,6 +1608,8 @@ void mesh_free(void *m) {
         return;
     }
 
+    mesh_retire_draws();
+
     mesh_t *mesh = (mesh_t *)m;
 
     if (mesh->assets != (void *)0x0)
@@ -485,11 +1628,92 @@ void mesh_free(void *m) {
     free(mesh);
 }
 
+/*
+ *    Draws any sorted surfaces, submits any pending triangles, waits
+ *    for them to be rasterized, and recycles the memory they used.
+ *
+ *    This is the frame's synchronization point for the threaded path,
+ *    nothing may read or clear the render target or depth buffer while
+ *    batches are still in flight.
+ */
+void mesh_flush(void) {
+    mesh_execute_draws();
+
+    if (mesh_surface_raster_func == mesh_surface_raster_threaded) {
+        mesh_submit_batch();
+        threadpool_wait();
+        arena_reset(&_tri_arena);
+    }
+
+    /*
+     *    No worker is binding layouts now, so layouts changed since
+     *    they were bound are picked up by the next flush. A kicked
+     *    pipelined frame may still be, so bin_kick does this instead.
+     */
+    if (!_frame_pipelined)
+        vertexasm_invalidate_layouts();
+}
+
+/*
+ *    Recycles the copies of assets recorded for the frame before the
+ *    last. The frame that was just kicked still reads its own copies,
+ *    and the one before it has been finished.
+ */
+void mesh_end_frame(void) {
+    if (!_frame_pipelined)
+        return;
+
+    _draw_arena ^= 1;
+    arena_reset(&_draw_arenas[_draw_arena]);
+}
+
 void mesh_init() {
-    if (args_has("--multithreaded-render")) {
+    _specialized_layouts = args_has("--specialized-layouts");
+
+    /*
+     *    A batch size of zero submits each surface as one batch.
+     */
+    if (args_has("--raster-batch-size")) {
+        _tri_batch_size = MAX(args_get_int("--raster-batch-size"), 0);
+    }
+
+    _parallel_vertex = args_has("--parallel-vertex-shading");
+
+    /*
+     *    Pipelined frames are rasterized while the game changes its
+     *    meshes' assets for the next one, so every draw is recorded
+     *    with a copy of them.
+     */
+    _draw_sorted = args_has("--sorted-draws") || _frame_pipelined;
+
+    /*
+     *    A depth prepass or a visibility buffer needs every triangle of
+     *    a render group before it can shade any of them, which is what
+     *    the bins keep, as do pipelined frames.
+     */
+    if (args_has("--tiled-render") || args_has("--depth-prepass") || args_has("--visibility-buffer") || _frame_pipelined) {
+        mesh_surface_raster_func = bin_triangle;
+    }
+    else if (args_has("--multithreaded-render")) {
         mesh_surface_raster_func = mesh_surface_raster_threaded;
     }
     else {
-        mesh_surface_raster_func = raster_rasterize_triangle;
+        mesh_surface_raster_func = mesh_surface_raster_serial;
     }
+
+    /*
+     *    Cleared tiles are filled by whoever draws to them first, which
+     *    threaded batches could do at once.
+     */
+    raster_enable_fast_clear(args_has("--fast-clear") && mesh_surface_raster_func != mesh_surface_raster_threaded);
+
+    /*
+     *    Tiles of the hierarchical depth buffer are worked out again by
+     *    whoever reads them, so they need a single owner. Threaded
+     *    batches draw anywhere at once, and pipelined frames record,
+     *    and cull, while the last frame is still drawn. Bins are fine,
+     *    as each lines up with whole tiles, and are only drawn while
+     *    nothing is being recorded.
+     */
+    raster_enable_hiz(args_has("--hi-z") && !_frame_pipelined && mesh_surface_raster_func != mesh_surface_raster_threaded);
 }
\ No newline at end of file
@@ -11,29 +11,58 @@
  */
 #pragma once
 
-#define CHIK_GFX_DRAWABLE_MESH_MAX_ASSETS 16
+#define CHIK_GFX_DRAWABLE_MESH_MAX_ASSETS   16
+#define CHIK_GFX_DRAWABLE_BATCH_SIZE        256
+#define CHIK_GFX_DRAWABLE_VERTEX_CHUNK      1024
+#define CHIK_GFX_DRAWABLE_VERTEX_MAX_CHUNKS 32
 
 #include "libchik.h"
 
 #include "image.h"
+#include "cull.h"
 
+/*
+ *    An axis aligned box and a sphere around a range of vertex
+ *    positions, in the space the vertex shader takes them in. An empty
+ *    range has a negative radius.
+ */
 typedef struct {
-    char        *buf;
-    unsigned int stride;
-    unsigned int size;
-    v_layout_t   layout;
+    vec3_t min;
+    vec3_t max;
+    vec3_t center;
+    float  radius;
+} mesh_bounds_t;
+
+typedef struct {
+    char         *buf;
+    unsigned int  stride;
+    unsigned int  size;
+    v_layout_t    layout;
+    char         *cache;
+    u32          *cache_stamp;
+    int           pos_offset;
+    mesh_bounds_t bounds;
 } vbuffer_t;
 
+typedef struct {
+    u32 *buf;
+    u32  count;
+} ibuffer_t;
+
 typedef struct {
     u32        offset;
     u32        size;
-    material_t material;
+    material_t    material;
+    cull_face_e   cull_mode;
+    mesh_bounds_t bounds;
 } mesh_surface_t;
 
 typedef struct {
     vbuffer_t      *vbuf;
+    ibuffer_t      *ibuf;
     mesh_surface_t *surfaces;
     u32             surface_count;
+    mesh_bounds_t   bounds;
     char           *assets;
     u64             assets_size;
     u64             assets_count;
@@ -51,6 +80,16 @@ typedef struct {
  */
 void *vbuffer_create(void *v, unsigned int size, unsigned int stride, v_layout_t layout);
 
+/*
+ *    Declares that a vertex buffer's v_add and v_scale only add and
+ *    scale every float of a vertex, leaving the position alone when
+ *    scaling. With --specialized-layouts, built in routines for exactly
+ *    its layout then stand in for them.
+ *
+ *    @param void *buf   The vertex buffer.
+ */
+void vbuffer_specialize(void *buf);
+
 /*
  *    Frees a vertex buffer.
  *
@@ -58,6 +97,23 @@ void *vbuffer_create(void *v, unsigned int size, unsigned int stride, v_layout_t
  */
 void vbuffer_free(void *buf);
 
+/*
+ *    Creates an index buffer.
+ *
+ *    @param void *i              The index data, as 32 bit indices.
+ *    @param u32   count          The amount of indices.
+ *
+ *    @return void *              The index buffer.
+ */
+void *ibuffer_create(void *i, u32 count);
+
+/*
+ *    Frees an index buffer.
+ *
+ *    @param void *buf   The index buffer to free.
+ */
+void ibuffer_free(void *buf);
+
 /*
  *    Creates a mesh.
  *
@@ -75,6 +131,15 @@ void *mesh_create(void *v);
  */
 void mesh_set_vbuffer(void *m, void *v);
 
+/*
+ *    Sets the index buffer of a mesh. Surfaces of an indexed mesh
+ *    refer to ranges of indices instead of vertices.
+ *
+ *    @param void *m    The mesh.
+ *    @param void *i    The index buffer, or NULL to draw unindexed.
+ */
+void mesh_set_ibuffer(void *m, void *i);
+
 /*
  *    Appends an asset to a mesh.
  *
@@ -133,6 +198,16 @@ bool mesh_set_surface_count(void *m, u32 count);
  */
 void mesh_set_surface_buffer_data(void *m, u32 surface, u32 offset, u32 size);
 
+/*
+ *    Sets which faces of a mesh surface are culled. Surfaces start out
+ *    with no face culling.
+ *
+ *    @param void *m              The mesh.
+ *    @param u32                  The surface to set the cull mode of
+ *    @param cull_face_e          The faces to cull
+ */
+void mesh_set_surface_cull_mode(void *m, u32 surface, cull_face_e mode);
+
 /*
  *    Gets a material on a mesh surface
  *
@@ -164,7 +239,11 @@ void mesh_set_asset(void *m, void *a, unsigned long size, unsigned long i);
 void *mesh_get_asset(void *a, unsigned long i);
 
 /*
- *    Draws a mesh.
+ *    Draws a mesh. With --sorted-draws or --pipelined-frames, the mesh
+ *    is only drawn when the render group is flushed. Freeing the mesh
+ *    or its buffers, or changing its buffers or surfaces, draws what
+ *    is still waiting first. Cull modes and materials changed before
+ *    then apply to the draws that are still waiting.
  *
  *    @param void *m    The mesh.
  */
@@ -177,6 +256,21 @@ void mesh_draw(void *m);
  */
 void mesh_free(void *m);
 
+/*
+ *    Draws any sorted surfaces, submits any pending triangles, waits
+ *    for them to be rasterized, and recycles the memory they used.
+ *    This must be called before the render target is presented or
+ *    cleared.
+ */
+void mesh_flush(void);
+
+/*
+ *    Recycles the copies of assets recorded for the frame before the
+ *    last, once its triangles have been rasterized. Only pipelined
+ *    frames need this, elsewhere mesh_flush recycles them.
+ */
+void mesh_end_frame(void);
+
 /*
  *    Initializes the mesh system.
  */
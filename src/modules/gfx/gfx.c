@@ -21,17 +21,35 @@ CHIK_MODULE(graphics_init, graphics_update, graphics_exit)
 
 #include "gfx.h"
 
+#include "bin.h"
 #include "cull.h"
 #include "drawable.h"
+#include "hiz.h"
+#include "occlusion.h"
 #include "raster.h"
 #include "rendertarget.h"
 #include "vertexasm.h"
 
-unsigned int (*platform_draw_image)(image_t *) = 0;
-vec2u_t (*platform_get_screen_size)(void)      = 0;
+unsigned int (*platform_draw_image)(image_t *)    = 0;
+unsigned int (*platform_acquire_image)(image_t *) = 0;
+vec2u_t (*platform_get_screen_size)(void)         = 0;
 
 extern rendertarget_t *_back_buffer;
 
+/*
+ *    With pipelined frames, one back buffer is rasterized to while the
+ *    other is presented.
+ */
+unsigned int    _frame_pipelined    = 0;
+rendertarget_t *_back_buffers[2]    = {nullptr, nullptr};
+unsigned int    _frame_in_flight    = 0;
+
+/*
+ *    With --zero-copy-present, back buffers are drawn straight into
+ *    memory lent by the platform, which it presents from.
+ */
+unsigned int    _frame_zero_copy    = 0;
+
 resource_t *_handles;
 
 /*
@@ -58,12 +76,58 @@ unsigned int graphics_init(void) {
         return 0;
     }
 
+    /*
+     *    Not every platform can lend memory to draw into, which only
+     *    means frames are copied when presented.
+     */
+    if (args_has("--zero-copy-present")) {
+        platform_acquire_image = engine_load_function("platform_acquire_image");
+
+        if (platform_acquire_image == nullptr)
+            LOGF_ERR("Failed to load platform_acquire_image, continuing without zero copy presents.\n");
+
+        _frame_zero_copy = platform_acquire_image != nullptr;
+    }
+
     raster_setup();
     cull_create_frustum();
     rendertarget_create_backbuffer();
+
+    /*
+     *    Every stage set up below reads whether frames are pipelined,
+     *    so it is settled first.
+     */
+    _frame_pipelined = args_has("--pipelined-frames");
+
+    if (_frame_pipelined) {
+        _back_buffers[0] = _back_buffer;
+        _back_buffers[1] = rendertarget_create(_back_buffer->target->width, _back_buffer->target->height, IMAGE_FMT_RGB8);
+
+        if (_back_buffers[1] == (rendertarget_t *)0x0) {
+            LOGF_ERR("Could not create second back buffer, continuing without pipelined frames.\n");
+            _frame_pipelined = 0;
+        }
+    }
+
     raster_set_rendertarget(_back_buffer);
+
+    if (_frame_zero_copy)
+        rendertarget_acquire_platform_image(_back_buffer);
+
+    /*
+     *    Frames are cleared once they are presented, and lent memory
+     *    holds whatever was in it, so the first frame is cleared here.
+     */
+    raster_clear_color(0xFF202020);
+    raster_clear_depth();
+
     mesh_init();
 
+    if (!bin_init()) {
+        LOGF_ERR("Failed to create triangle bins.\n");
+        return 0;
+    }
+
     return 1;
 }
 
@@ -79,7 +143,13 @@ unsigned int graphics_update(float dt) { return 1; }
 /*
  *    Cleans up the graphics subsystem.
  */
-unsigned int graphics_exit(void) { return 1; }
+unsigned int graphics_exit(void) {
+    bin_free();
+    hiz_free();
+    occlusion_free();
+
+    return 1;
+}
 
 /*
  *    Creates a camera.
@@ -174,6 +244,8 @@ void set_camera_fov(void *camera, float fov) {
  */
 void set_camera(void *cam) {
     _camera = cam;
+
+    cull_create_frustum();
 }
 
 /*
@@ -199,7 +271,21 @@ mat4_t get_camera_view(void *cam) {
  *    Begins a new render group.
  */
 void begin_render_group(void) {
-    raster_clear_depth();
+    /*
+     *    Finish the previous group before its depth is cleared. With
+     *    pipelined frames, the group is still only recorded, so each
+     *    tile is told to clear its depth after the group instead.
+     */
+    mesh_flush();
+
+    if (_frame_pipelined) {
+        bin_mark_depth_clear();
+    } else {
+        bin_flush();
+        raster_clear_depth();
+    }
+
+    occlusion_render();
 }
 
 /*
@@ -216,11 +302,62 @@ vec2_t get_screen_size(void) {
     return size;
 }
 
+/*
+ *    Draws the current frame, overlapped with the last one. Once the
+ *    last frame has been rasterized, this one is started on the
+ *    threadpool against the other back buffer, and the last one is
+ *    presented while it runs, so what is shown is a frame behind.
+ */
+static void draw_frame_pipelined(void) {
+    rendertarget_t *finished = _back_buffer;
+
+    /*
+     *    Whatever is left of this frame's draws is transformed and
+     *    binned while the last frame is still being rasterized.
+     */
+    mesh_flush();
+    bin_finish();
+    raster_resolve_color();
+
+    _back_buffer = _back_buffers[0] == finished ? _back_buffers[1] : _back_buffers[0];
+
+    if (_frame_zero_copy)
+        rendertarget_acquire_platform_image(_back_buffer);
+
+    raster_set_rendertarget(_back_buffer);
+    raster_clear_color(0xFF202020);
+    raster_clear_depth();
+    bin_kick();
+    mesh_end_frame();
+
+    if (_frame_in_flight)
+        platform_draw_image(finished->target);
+
+    _frame_in_flight = 1;
+}
+
 /*
  *    Draws the current frame.
  */
 void draw_frame(void) {
+    if (_frame_pipelined) {
+        draw_frame_pipelined();
+        return;
+    }
+
+    /*
+     *    Frame barrier, every triangle submitted this frame has to be
+     *    rasterized before the back buffer is handed to the platform.
+     */
+    mesh_flush();
+    bin_flush();
+    mesh_end_frame();
+    raster_resolve_color();
     platform_draw_image(_back_buffer->target);
-    image_clear(_back_buffer->target, 0xFF202020);
+
+    if (_frame_zero_copy)
+        rendertarget_acquire_platform_image(_back_buffer);
+
+    raster_clear_color(0xFF202020);
     raster_clear_depth();
 }
\ No newline at end of file
@@ -15,4 +15,11 @@
 
 extern resource_t *_handles;
 
+/*
+ *    Whether frames are pipelined, decided once by graphics_init for
+ *    every stage, as it falls back to serial frames if it cannot set
+ *    them up.
+ */
+extern unsigned int _frame_pipelined;
+
 #endif /* CHIK_GFX_H  */
\ No newline at end of file
@@ -0,0 +1,458 @@
+/*
+ *    halfspace.c    --    source for the half-space rasterizer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The half-space rasterizer is defined here. Vertex attributes are
+ *    interpolated the same way as the scanline rasterizer does, by
+ *    scaling them by the inverse depth at each vertex and dividing
+ *    again per pixel, but the per-row vertex rebuilds are replaced with
+ *    screen-space gradients set up once per triangle.
+ */
+#include "halfspace.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HALFSPACE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "depth.h"
+#include "hiz.h"
+#include "vertexasm.h"
+#include "visbuf.h"
+
+/*
+ *    A block is tested against the one hierarchical depth tile it
+ *    lies in, which only holds if the two are the same size.
+ */
+_Static_assert(HALFSPACE_BLOCK_SIZE == HIZ_TILE_SIZE, "halfspace blocks must line up with hi-z tiles");
+
+typedef struct {
+    float a;
+    float b;
+    float c;
+    float thr;
+} halfspace_edge_t;
+
+extern rendertarget_t *_raster_target;
+extern depthbuffer_t  *_z_buffer;
+
+extern THREAD_LOCAL v_layout_t    _layout;
+extern THREAD_LOCAL raster_pass_e _raster_pass;
+extern THREAD_LOCAL u32           _raster_triangle_id;
+
+/*
+ *    Sets up the edge function running from p to q, such that
+ *    E(x, y) = a * x + b * y + c is positive to the left of the edge.
+ *
+ *    Pixels exactly on an edge are only owned by one of the two
+ *    triangles sharing it, which is done by requiring the edge function
+ *    be strictly positive on edges that aren't top-left.
+ *
+ *    @param halfspace_edge_t *e    The edge to set up.
+ *    @param vec2_t p               The start of the edge.
+ *    @param vec2_t q               The end of the edge.
+ */
+static void halfspace_edge(halfspace_edge_t *e, vec2_t p, vec2_t q) {
+    e->a   = p.y - q.y;
+    e->b   = q.x - p.x;
+    e->c   = -(e->a * p.x + e->b * p.y);
+    e->thr = (e->a > 0.f || (e->a == 0.f && e->b > 0.f)) ? 0.f : FLT_MIN;
+}
+
+/*
+ *    Returns the index of the lowest set bit.
+ *
+ *    @param unsigned int mask    The mask, which must not be zero.
+ *
+ *    @return unsigned int        The index of the lowest set bit.
+ */
+static inline unsigned int halfspace_ctz(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+
+    _BitScanForward(&idx, mask);
+
+    return idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/*
+ *    Evaluates the coverage of one row of a block.
+ *
+ *    @param halfspace_edge_t *e    The three edges of the triangle.
+ *    @param float *steps           The per-column step of each edge.
+ *    @param float *row             The value of each edge at the first pixel of the row.
+ *
+ *    @return unsigned int          A mask with a bit set for every covered column.
+ */
+static inline unsigned int halfspace_row_mask(halfspace_edge_t *e, float steps[3][HALFSPACE_BLOCK_SIZE], float *row) {
+#if defined(__AVX2__)
+    __m256 m = _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(row[0]), _mm256_loadu_ps(steps[0])),
+                             _mm256_set1_ps(e[0].thr), _CMP_GE_OQ);
+    m = _mm256_and_ps(m, _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(row[1]), _mm256_loadu_ps(steps[1])),
+                                       _mm256_set1_ps(e[1].thr), _CMP_GE_OQ));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(row[2]), _mm256_loadu_ps(steps[2])),
+                                       _mm256_set1_ps(e[2].thr), _CMP_GE_OQ));
+
+    return _mm256_movemask_ps(m);
+#elif defined(HALFSPACE_SSE2)
+    size_t       i;
+    unsigned int mask = 0;
+
+    for (i = 0; i < HALFSPACE_BLOCK_SIZE; i += 4) {
+        __m128 m = _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(row[0]), _mm_loadu_ps(&steps[0][i])), _mm_set1_ps(e[0].thr));
+        m = _mm_and_ps(m, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(row[1]), _mm_loadu_ps(&steps[1][i])), _mm_set1_ps(e[1].thr)));
+        m = _mm_and_ps(m, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(row[2]), _mm_loadu_ps(&steps[2][i])), _mm_set1_ps(e[2].thr)));
+
+        mask |= _mm_movemask_ps(m) << i;
+    }
+
+    return mask;
+#else
+    size_t       i;
+    unsigned int mask = 0;
+
+    for (i = 0; i < HALFSPACE_BLOCK_SIZE; i++) {
+        if (row[0] + steps[0][i] >= e[0].thr && row[1] + steps[1][i] >= e[1].thr &&
+            row[2] + steps[2][i] >= e[2].thr)
+            mask |= 1 << i;
+    }
+
+    return mask;
+#endif
+}
+
+/*
+ *    Rasterizes a single triangle with edge functions, only touching
+ *    pixels inside of a rectangle.
+ *
+ *    @param void *r0              The raw vertex data for the first vertex.
+ *    @param void *r1              The raw vertex data for the second vertex.
+ *    @param void *r2              The raw vertex data for the third vertex.
+ *    @param raster_rect_t *rect   The rectangle to restrict drawing to.
+ */
+void halfspace_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, material_t *mat, raster_rect_t *rect) {
+    size_t           i;
+    unsigned int     k;
+    unsigned int     row;
+    unsigned int     mask;
+    unsigned int     cols;
+    unsigned int     accept;
+    unsigned int     reject;
+    unsigned int     written;
+    int              x;
+    int              y;
+    int              bx;
+    int              by;
+    int              min_x;
+    int              min_y;
+    int              max_x;
+    int              max_y;
+    int              width;
+    int              height;
+    unsigned int     stride;
+    float            area;
+    float            inv_area;
+    float            z;
+    float            iz;
+    float            dzdx;
+    float            dzdy;
+    float            z_block;
+    float            b1;
+    float            b2;
+    float            e_block[3];
+    float            e_row[3];
+    float            steps[3][HALFSPACE_BLOCK_SIZE];
+    u32              depth;
+    u32              key;
+    u32              stored;
+    unsigned char   *raster;
+    void            *tempv;
+    vec2_t           s0;
+    vec2_t           s1;
+    vec2_t           s2;
+    vec2_t           temps;
+    vec4_t           tempp;
+    vec4_t           pa;
+    vec4_t           pb;
+    vec4_t           pc;
+    halfspace_edge_t e[3];
+    fragment_t       f;
+    unsigned char    pIA[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    pIB[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    pIC[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    dvdx[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    dvdy[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    vrow[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    v[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    scaled_v[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char    tmp[VERTEX_ASM_MAX_VERTEX_SIZE];
+    void (*f_fun)(fragment_t *, void *, void *, material_t *) = _layout.f_fun;
+    void (*v_scale)(void *, void *, float) = _layout_info.v_scale;
+    void (*v_add)(void *, void *, void *) = _layout_info.v_add;
+    raster_pass_e    pass = _raster_pass;
+
+    pa = vertex_get_position(r0);
+    pb = vertex_get_position(r1);
+    pc = vertex_get_position(r2);
+
+    if (pa.z == 0.0f || pb.z == 0.0f || pc.z == 0.0f) {
+        return;
+    }
+
+    /*
+     *    Map the normalized coordinates to screen coordinates.
+     */
+    width  = _raster_target->target->width;
+    height = _raster_target->target->height;
+
+    s0.x = (pa.x + 1.0f) * width / 2;
+    s0.y = (pa.y + 1.0f) * height / 2;
+    s1.x = (pb.x + 1.0f) * width / 2;
+    s1.y = (pb.y + 1.0f) * height / 2;
+    s2.x = (pc.x + 1.0f) * width / 2;
+    s2.y = (pc.y + 1.0f) * height / 2;
+
+    /*
+     *    Wind the triangle counter-clockwise, so that the inside of
+     *    every edge is positive.
+     */
+    area = (s1.x - s0.x) * (s2.y - s0.y) - (s1.y - s0.y) * (s2.x - s0.x);
+
+    if (area == 0.f) {
+        return;
+    }
+
+    if (area < 0.f) {
+        temps = s1;
+        s1    = s2;
+        s2    = temps;
+
+        tempv = r1;
+        r1    = r2;
+        r2    = tempv;
+
+        tempp = pb;
+        pb    = pc;
+        pc    = tempp;
+
+        area = -area;
+    }
+
+    /*
+     *    Find the pixels the triangle can touch.
+     */
+    min_x = MAX((int)floorf(MIN(MIN(s0.x, s1.x), s2.x)), rect->x0);
+    min_y = MAX((int)floorf(MIN(MIN(s0.y, s1.y), s2.y)), rect->y0);
+    max_x = MIN((int)ceilf(MAX(MAX(s0.x, s1.x), s2.x)), rect->x1 - 1);
+    max_y = MIN((int)ceilf(MAX(MAX(s0.y, s1.y), s2.y)), rect->y1 - 1);
+
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+
+    /*
+     *    Scale vertex attributes by their inverse z-coordinates, as the
+     *    scanline rasterizer does, so that they interpolate linearly
+     *    in screen space.
+     */
+    vertex_scale(pIA, r0, 1 / pa.z, V_POS);
+    vertex_scale(pIB, r1, 1 / pb.z, V_POS);
+    vertex_scale(pIC, r2, 1 / pc.z, V_POS);
+
+    pa = vertex_get_position(pIA);
+    pb = vertex_get_position(pIB);
+    pc = vertex_get_position(pIC);
+
+    pa.z = 1 / pa.z;
+    pb.z = 1 / pb.z;
+    pc.z = 1 / pc.z;
+
+    vertex_set_position(pIA, pa);
+    vertex_set_position(pIB, pb);
+    vertex_set_position(pIC, pc);
+
+    /*
+     *    Edge i is opposite of vertex i, so the value of edge i divided
+     *    by the area is the barycentric weight of vertex i.
+     */
+    halfspace_edge(&e[0], s1, s2);
+    halfspace_edge(&e[1], s2, s0);
+    halfspace_edge(&e[2], s0, s1);
+
+    inv_area = 1.0f / area;
+
+    for (i = 0; i < 3; i++) {
+        for (k = 0; k < HALFSPACE_BLOCK_SIZE; k++) {
+            steps[i][k] = e[i].a * k;
+        }
+    }
+
+    /*
+     *    Build the screen space gradients of the attributes and depth.
+     *    Since V = A + (B - A) * b1 + (C - A) * b2, the gradients are
+     *    just the edge gradients scaled by the vertex differences.
+     */
+    vertex_build_differential(tmp, pIA, pIB, e[1].a * inv_area);
+    vertex_build_differential(dvdx, pIA, pIC, e[2].a * inv_area);
+    v_add(dvdx, dvdx, tmp);
+
+    vertex_build_differential(tmp, pIA, pIB, e[1].b * inv_area);
+    vertex_build_differential(dvdy, pIA, pIC, e[2].b * inv_area);
+    v_add(dvdy, dvdy, tmp);
+
+    dzdx   = ((pb.z - pa.z) * e[1].a + (pc.z - pa.z) * e[2].a) * inv_area;
+    dzdy   = ((pb.z - pa.z) * e[1].b + (pc.z - pa.z) * e[2].b) * inv_area;
+    stride = _layout.stride;
+
+    for (by = min_y & ~(HALFSPACE_BLOCK_SIZE - 1); by <= max_y; by += HALFSPACE_BLOCK_SIZE) {
+        for (bx = min_x & ~(HALFSPACE_BLOCK_SIZE - 1); bx <= max_x; bx += HALFSPACE_BLOCK_SIZE) {
+            /*
+             *    Test the block's corners against every edge. If any
+             *    edge has the whole block outside, skip it, and if every
+             *    edge has the whole block inside, skip coverage tests.
+             */
+            accept = 1;
+            reject = 0;
+
+            for (i = 0; i < 3; i++) {
+                e_block[i] = e[i].a * (bx + 0.5f) + e[i].b * (by + 0.5f) + e[i].c;
+
+                if (e_block[i] + (MAX(e[i].a, 0.f) + MAX(e[i].b, 0.f)) * (HALFSPACE_BLOCK_SIZE - 1) < e[i].thr) {
+                    reject = 1;
+                    break;
+                }
+
+                if (e_block[i] + (MIN(e[i].a, 0.f) + MIN(e[i].b, 0.f)) * (HALFSPACE_BLOCK_SIZE - 1) < e[i].thr) {
+                    accept = 0;
+                }
+            }
+
+            if (reject) {
+                continue;
+            }
+
+            cols = 0;
+
+            for (k = 0; k < HALFSPACE_BLOCK_SIZE; k++) {
+                if (bx + (int)k >= rect->x0 && bx + (int)k < rect->x1)
+                    cols |= 1 << k;
+            }
+
+            /*
+             *    Interpolate the attributes at the block's first pixel.
+             */
+            b1      = e_block[1] * inv_area;
+            b2      = e_block[2] * inv_area;
+            z_block = pa.z + (pb.z - pa.z) * b1 + (pc.z - pa.z) * b2;
+
+            /*
+             *    The block lines up with a tile of the hierarchical
+             *    depth buffer, so skip it if its nearest point is hidden.
+             */
+            if (_hiz.enabled && pass != RASTER_PASS_SHADE) {
+                z = z_block + (MAX(dzdx, 0.f) + MAX(dzdy, 0.f)) * (HALFSPACE_BLOCK_SIZE - 1);
+
+                if (z > 0.f && 1.0f / z >= hiz_tile_max(bx / HIZ_TILE_SIZE, by / HIZ_TILE_SIZE)) {
+                    continue;
+                }
+            }
+
+            written = 0;
+
+            memcpy(vrow, vertex_build_interpolated(pIA, pIB, b1), stride);
+            vertex_build_differential(tmp, pIA, pIC, b2);
+            v_add(vrow, vrow, tmp);
+
+            for (row = 0; row < HALFSPACE_BLOCK_SIZE; row++, v_add(vrow, vrow, dvdy)) {
+                y = by + row;
+
+                if (y < rect->y0 || y >= rect->y1) {
+                    continue;
+                }
+
+                if (accept) {
+                    mask = cols;
+                } else {
+                    e_row[0] = e_block[0] + e[0].b * row;
+                    e_row[1] = e_block[1] + e[1].b * row;
+                    e_row[2] = e_block[2] + e[2].b * row;
+
+                    mask = halfspace_row_mask(e, steps, e_row) & cols;
+                }
+
+                if (mask == 0) {
+                    continue;
+                }
+
+                depth  = bx + y * width;
+                raster = (unsigned char *)_raster_target->target->buf + (y * width + bx) * 3;
+
+                memcpy(v, vrow, stride);
+
+                /*
+                 *    Walk the covered pixels of the row, stepping the
+                 *    attributes along as we go.
+                 */
+                k = 0;
+
+                while (mask) {
+                    x     = halfspace_ctz(mask);
+                    mask &= mask - 1;
+
+                    for (; k < (unsigned int)x; k++) {
+                        v_add(v, v, dvdx);
+                    }
+
+                    z      = z_block + dzdx * x + dzdy * row;
+                    iz     = 1.0f / z;
+                    key    = depth_encode(_z_buffer, iz);
+                    stored = depth_load(_z_buffer, depth + x);
+
+                    if (pass == RASTER_PASS_SHADE ? stored != key : stored <= key) {
+                        continue;
+                    }
+
+                    if (pass != RASTER_PASS_SHADE) {
+                        depth_store(_z_buffer, depth + x, key);
+                        written = 1;
+                    }
+
+                    if (pass == RASTER_PASS_VISIBILITY) {
+                        _visbuf[bx + x + y * width] = _raster_triangle_id;
+                        continue;
+                    }
+
+                    if (pass == RASTER_PASS_DEPTH) {
+                        continue;
+                    }
+
+                    f.pos.x = bx + x;
+                    f.pos.y = y;
+
+                    v_scale(scaled_v, v, iz);
+                    f_fun(&f, scaled_v, assets, mat);
+
+                    memcpy(raster + x * 3, &f.color, 3);
+                }
+            }
+
+            if (written) {
+                hiz_mark_span(bx, bx + 1, by);
+            }
+        }
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ *    halfspace.h    --    header for the half-space rasterizer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The half-space rasterizer is an alternative to the scanline
+ *    rasterizer. It describes a triangle as the intersection of its
+ *    three edge functions, and walks the screen in fixed-size pixel
+ *    blocks. Blocks entirely outside of an edge are skipped, blocks
+ *    entirely inside of every edge skip coverage testing, and the
+ *    remaining blocks have their coverage evaluated a row at a time
+ *    with SSE or AVX2 when available.
+ */
+#ifndef CHIK_GFX_HALFSPACE_H
+#define CHIK_GFX_HALFSPACE_H
+
+#include "libchik.h"
+
+#include "raster.h"
+
+#define HALFSPACE_BLOCK_SIZE 8
+
+/*
+ *    Rasterizes a single triangle with edge functions, only touching
+ *    pixels inside of a rectangle.
+ *
+ *    @param void *          The raw vertex data for the first vertex.
+ *    @param void *          The raw vertex data for the second vertex.
+ *    @param void *          The raw vertex data for the third vertex.
+ *    @param raster_rect_t * The rectangle to restrict drawing to.
+ */
+void halfspace_rasterize_triangle(void *spV1, void *spV2, void *spV3, void *assets, material_t *mat, raster_rect_t *rect);
+
+#endif /* CHIK_GFX_HALFSPACE_H  */
@@ -0,0 +1,205 @@
+/*
+ *    hiz.c    --    source for the hierarchical depth buffer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The depth buffer holds a float per pixel, with nearer pixels
+ *    having smaller depths.
+ */
+#include "hiz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "depth.h"
+
+extern depthbuffer_t *_z_buffer;
+
+hiz_t _hiz = {0};
+
+/*
+ *    Sets up the hierarchical depth buffer for a depth buffer.
+ *
+ *    @param unsigned int width     The width of the depth buffer.
+ *    @param unsigned int height    The height of the depth buffer.
+ *
+ *    @return unsigned int          1 on success, 0 on failure.
+ */
+unsigned int hiz_init(unsigned int width, unsigned int height) {
+    u64 tiles;
+
+    hiz_free();
+
+    _hiz.tiles_x = (width + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    _hiz.tiles_y = (height + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    tiles        = (u64)_hiz.tiles_x * _hiz.tiles_y;
+
+    _hiz.min   = malloc(sizeof(float) * tiles);
+    _hiz.max   = malloc(sizeof(float) * tiles);
+    _hiz.dirty = malloc(tiles);
+
+    if (_hiz.min == (float *)0x0 || _hiz.max == (float *)0x0 || _hiz.dirty == (unsigned char *)0x0) {
+        LOGF_ERR("Could not allocate hierarchical depth buffer.\n");
+        hiz_free();
+        return 0;
+    }
+
+    /*
+     *    The depth buffer may already hold depth, so every tile is
+     *    worked out from it the first time it is asked for.
+     */
+    memset(_hiz.dirty, 1, tiles);
+
+    _hiz.enabled = 1;
+
+    return 1;
+}
+
+/*
+ *    Resets every tile to a cleared depth.
+ *
+ *    @param float depth    The depth the depth buffer was cleared to.
+ */
+void hiz_clear(float depth) {
+    int i;
+
+    if (!_hiz.enabled)
+        return;
+
+    for (i = 0; i < _hiz.tiles_x * _hiz.tiles_y; i++) {
+        _hiz.min[i] = depth;
+        _hiz.max[i] = depth;
+    }
+
+    memset(_hiz.dirty, 0, _hiz.tiles_x * _hiz.tiles_y);
+}
+
+/*
+ *    Marks the tiles under a span of a row as written to.
+ *
+ *    @param int x0    The first pixel of the span.
+ *    @param int x1    One past the last pixel of the span.
+ *    @param int y     The row of the span.
+ */
+void hiz_mark_span(int x0, int x1, int y) {
+    int            tx;
+    unsigned char *dirty;
+
+    if (!_hiz.enabled || x0 >= x1)
+        return;
+
+    dirty = _hiz.dirty + (y / HIZ_TILE_SIZE) * _hiz.tiles_x;
+
+    for (tx = x0 / HIZ_TILE_SIZE; tx <= (x1 - 1) / HIZ_TILE_SIZE; tx++) {
+        dirty[tx] = 1;
+    }
+}
+
+/*
+ *    Works the bounds of a written to tile out again from the depth
+ *    buffer.
+ *
+ *    @param int tx    The tile's column.
+ *    @param int ty    The tile's row.
+ */
+static void hiz_update_tile(int tx, int ty) {
+    int    x;
+    int    y;
+    int    i     = tx + ty * _hiz.tiles_x;
+    int    width = _z_buffer->width;
+    int    x1    = MIN((tx + 1) * HIZ_TILE_SIZE, width);
+    int    y1    = MIN((ty + 1) * HIZ_TILE_SIZE, (int)_z_buffer->height);
+    u32    lo;
+    u32    hi;
+    u32    v;
+    u32    depth;
+
+    /*
+     *    Clear the mark first, so a write landing while the tile is
+     *    read marks it again.
+     */
+    _hiz.dirty[i] = 0;
+
+    /*
+     *    Encoded depths order the same as depths, so the bounds are
+     *    found on them, and only decoded once.
+     */
+    depth = tx * HIZ_TILE_SIZE + ty * HIZ_TILE_SIZE * width;
+    lo    = depth_load(_z_buffer, depth);
+    hi    = lo;
+
+    for (y = ty * HIZ_TILE_SIZE; y < y1; y++, depth += width) {
+        for (x = 0; x < x1 - tx * HIZ_TILE_SIZE; x++) {
+            v  = depth_load(_z_buffer, depth + x);
+            lo = MIN(lo, v);
+            hi = MAX(hi, v);
+        }
+    }
+
+    _hiz.min[i] = depth_decode(_z_buffer, lo);
+    _hiz.max[i] = depth_decode(_z_buffer, hi);
+}
+
+/*
+ *    Returns the farthest depth in a tile.
+ *
+ *    @param int tx    The tile's column.
+ *    @param int ty    The tile's row.
+ *
+ *    @return float    The farthest depth.
+ */
+float hiz_tile_max(int tx, int ty) {
+    if (_hiz.dirty[tx + ty * _hiz.tiles_x])
+        hiz_update_tile(tx, ty);
+
+    return _hiz.max[tx + ty * _hiz.tiles_x];
+}
+
+/*
+ *    Checks whether something at a depth is hidden everywhere in a
+ *    rectangle.
+ *
+ *    @param raster_rect_t *rect    The rectangle, in pixels.
+ *    @param float          depth   The nearest depth of what is tested.
+ *
+ *    @return unsigned int          1 if it is hidden, 0 otherwise.
+ */
+unsigned int hiz_rect_occluded(raster_rect_t *rect, float depth) {
+    int tx;
+    int ty;
+    int tx0;
+    int ty0;
+    int tx1;
+    int ty1;
+
+    if (!_hiz.enabled || rect->x0 >= rect->x1 || rect->y0 >= rect->y1)
+        return 0;
+
+    tx0 = MAX(rect->x0, 0) / HIZ_TILE_SIZE;
+    ty0 = MAX(rect->y0, 0) / HIZ_TILE_SIZE;
+    tx1 = MIN((rect->x1 - 1) / HIZ_TILE_SIZE, _hiz.tiles_x - 1);
+    ty1 = MIN((rect->y1 - 1) / HIZ_TILE_SIZE, _hiz.tiles_y - 1);
+
+    for (ty = ty0; ty <= ty1; ty++) {
+        for (tx = tx0; tx <= tx1; tx++) {
+            if (depth < hiz_tile_max(tx, ty))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ *    Frees the hierarchical depth buffer.
+ */
+void hiz_free(void) {
+    free(_hiz.min);
+    free(_hiz.max);
+    free(_hiz.dirty);
+
+    _hiz.min     = (float *)0x0;
+    _hiz.max     = (float *)0x0;
+    _hiz.dirty   = (unsigned char *)0x0;
+    _hiz.enabled = 0;
+}
@@ -0,0 +1,92 @@
+/*
+ *    hiz.h    --    header for the hierarchical depth buffer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The hierarchical depth buffer keeps the nearest and farthest
+ *    depth of every small tile of the depth buffer. Anything whose
+ *    nearest depth is no nearer than the farthest depth of every tile
+ *    it covers is hidden, which lets whole meshes, triangles and pixel
+ *    blocks be thrown away before any per pixel work.
+ *
+ *    Tiles are only marked when written to, and their bounds are
+ *    worked out again the next time they are asked for. Since depth
+ *    only ever gets nearer, a stale bound is still a safe one.
+ *
+ *    Nothing here is synchronized, as asking for a tile may write it.
+ *    A tile must only ever be used by one thread at a time, which
+ *    raster_enable_hiz is only turned on for.
+ */
+#ifndef CHIK_GFX_HIZ_H
+#define CHIK_GFX_HIZ_H
+
+#include "libchik.h"
+
+#include "raster.h"
+
+#define HIZ_TILE_SIZE 8
+
+typedef struct {
+    unsigned int   enabled;
+    int            tiles_x;
+    int            tiles_y;
+    float         *min;
+    float         *max;
+    unsigned char *dirty;
+} hiz_t;
+
+extern hiz_t _hiz;
+
+/*
+ *    Sets up the hierarchical depth buffer for a depth buffer.
+ *
+ *    @param unsigned int width     The width of the depth buffer.
+ *    @param unsigned int height    The height of the depth buffer.
+ *
+ *    @return unsigned int          1 on success, 0 on failure.
+ */
+unsigned int hiz_init(unsigned int width, unsigned int height);
+
+/*
+ *    Resets every tile to a cleared depth.
+ *
+ *    @param float depth    The depth the depth buffer was cleared to.
+ */
+void hiz_clear(float depth);
+
+/*
+ *    Marks the tiles under a span of a row as written to.
+ *
+ *    @param int x0    The first pixel of the span.
+ *    @param int x1    One past the last pixel of the span.
+ *    @param int y     The row of the span.
+ */
+void hiz_mark_span(int x0, int x1, int y);
+
+/*
+ *    Returns the farthest depth in a tile.
+ *
+ *    @param int tx    The tile's column.
+ *    @param int ty    The tile's row.
+ *
+ *    @return float    The farthest depth.
+ */
+float hiz_tile_max(int tx, int ty);
+
+/*
+ *    Checks whether something at a depth is hidden everywhere in a
+ *    rectangle.
+ *
+ *    @param raster_rect_t *rect    The rectangle, in pixels.
+ *    @param float          depth   The nearest depth of what is tested.
+ *
+ *    @return unsigned int          1 if it is hidden, 0 otherwise.
+ */
+unsigned int hiz_rect_occluded(raster_rect_t *rect, float depth);
+
+/*
+ *    Frees the hierarchical depth buffer.
+ */
+void hiz_free(void);
+
+#endif /* CHIK_GFX_HIZ_H  */
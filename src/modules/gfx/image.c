@@ -12,6 +12,7 @@
 #include <malloc.h>
 #include <string.h>
 
+#include "bin.h"
 #include "gfx.h"
 
 /*
@@ -211,13 +212,49 @@ unsigned int image_clear(image_t *image, unsigned int color) {
     }
 
     /*
-     *    Fastest way to clear is to memset the entire buffer.
+     *    Rows are contiguous, so the whole image is one long row.
      */
-    memset(image->buf, color, image->width * image->height * _pixel_sizes[image->fmt]);
+    image_clear_rect(image, color, 0, 0, image->width * image->height, 1);
 
     return 1;
 }
 
+/*
+ *    Clears a rectangle of an image.
+ *
+ *    @param  image_t *image        The image.
+ *    @param  unsigned int color    The color to clear the rectangle with.
+ *    @param  unsigned int x0       The left of the rectangle.
+ *    @param  unsigned int y0       The top of the rectangle.
+ *    @param  unsigned int x1       One past the right of the rectangle.
+ *    @param  unsigned int y1       One past the bottom of the rectangle.
+ */
+void image_clear_rect(image_t *image, unsigned int color, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) {
+    size_t size  = _pixel_sizes[image->fmt];
+    size_t row   = (x1 - x0) * size;
+    size_t pitch = (y1 > y0 + 1 ? image->width : 0) * size;
+    size_t done;
+    char  *first = (char *)image->buf + (y0 * image->width + x0) * size;
+    char  *dst;
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    /*
+     *    A memset only repeats a byte, so write the pixel once, and then
+     *    keep doubling what has been written to fill out the row.
+     */
+    memcpy(first, &color, size);
+
+    for (done = size; done < row; done *= 2) {
+        memcpy(first + done, first, MIN(done, row - done));
+    }
+
+    for (dst = first + pitch, y0++; y0 < y1; y0++, dst += pitch) {
+        memcpy(dst, first, row);
+    }
+}
+
 /*
  *    Frees an image.
  *
@@ -229,6 +266,11 @@ void image_free(image_t *image) {
         return;
     }
 
+    /*
+     *    A pipelined frame still in flight may be sampling the image.
+     */
+    bin_finish();
+
     free(image->buf);
     free(image);
 }
\ No newline at end of file
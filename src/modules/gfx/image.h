@@ -112,6 +112,18 @@ unsigned int image_set_pixel(image_t *image, unsigned int x, unsigned int y, uns
  */
 unsigned int image_clear(image_t *image, unsigned int color);
 
+/*
+ *    Clears a rectangle of an image.
+ *
+ *    @param  image_t *image        The image.
+ *    @param  unsigned int color    The color to clear the rectangle with.
+ *    @param  unsigned int x0       The left of the rectangle.
+ *    @param  unsigned int y0       The top of the rectangle.
+ *    @param  unsigned int x1       One past the right of the rectangle.
+ *    @param  unsigned int y1       One past the bottom of the rectangle.
+ */
+void image_clear_rect(image_t *image, unsigned int color, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+
 /*
  *    Frees an image.
  *
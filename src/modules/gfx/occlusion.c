@@ -0,0 +1,387 @@
+/*
+ *    occlusion.c    --    source for software occlusion culling
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    Depths in the occlusion buffer are clip space z, like the depth
+ *    buffer, with nearer pixels having smaller depths.
+ */
+#include "occlusion.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drawable.h"
+#include "vertexasm.h"
+
+extern float _clip_near;
+
+mesh_t      *_occluders[OCCLUSION_MAX_OCCLUDERS];
+u32          _occluder_count = 0;
+unsigned int _occlusion_ready = 0;
+float        _occlusion_depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT];
+vec4_t      *_occluder_positions = (vec4_t *)0x0;
+u32          _occluder_positions_size = 0;
+
+/*
+ *    Adds a mesh to the occluders. Its vertex shader and assets should
+ *    place it in clip space as they would when drawing it, by the time
+ *    the next render group begins.
+ *
+ *    @param void *m    The mesh.
+ */
+void occlusion_add_occluder(void *m) {
+    if (m == (void *)0x0) {
+        LOGF_ERR("Mesh is null.\n");
+        return;
+    }
+
+    if (_occluder_count >= OCCLUSION_MAX_OCCLUDERS) {
+        LOGF_ERR("Too many occluders.\n");
+        return;
+    }
+
+    _occluders[_occluder_count++] = (mesh_t *)m;
+}
+
+/*
+ *    Removes a mesh from the occluders.
+ *
+ *    @param void *m    The mesh.
+ */
+void occlusion_remove_occluder(void *m) {
+    for (u32 i = 0; i < _occluder_count; i++) {
+        if (_occluders[i] == (mesh_t *)m) {
+            _occluders[i] = _occluders[--_occluder_count];
+            break;
+        }
+    }
+
+    if (_occluder_count == 0)
+        _occlusion_ready = 0;
+}
+
+/*
+ *    Rasterizes a triangle into the occlusion buffer. Only pixels the
+ *    triangle covers entirely are written, with the farthest depth of
+ *    the triangle inside of them.
+ *
+ *    @param vec4_t *p0    The first position, in clip space.
+ *    @param vec4_t *p1    The second position, in clip space.
+ *    @param vec4_t *p2    The third position, in clip space.
+ */
+static void occlusion_rasterize_triangle(vec4_t *p0, vec4_t *p1, vec4_t *p2) {
+    float   t;
+    float   x[3];
+    float   y[3];
+    float   iz[3];
+    float   area;
+    float   a[3];
+    float   b[3];
+    float   c[3];
+    float   dzdx;
+    float   dzdy;
+    float   slack;
+    float   iz_min;
+    float   z;
+    int     x0;
+    int     y0;
+    int     x1;
+    int     y1;
+
+    if (p0->w <= 0.f || p1->w <= 0.f || p2->w <= 0.f)
+        return;
+
+    x[0] = (p0->x / p0->w + 1.0f) * OCCLUSION_WIDTH / 2;
+    y[0] = (p0->y / p0->w + 1.0f) * OCCLUSION_HEIGHT / 2;
+    x[1] = (p1->x / p1->w + 1.0f) * OCCLUSION_WIDTH / 2;
+    y[1] = (p1->y / p1->w + 1.0f) * OCCLUSION_HEIGHT / 2;
+    x[2] = (p2->x / p2->w + 1.0f) * OCCLUSION_WIDTH / 2;
+    y[2] = (p2->y / p2->w + 1.0f) * OCCLUSION_HEIGHT / 2;
+
+    iz[0] = 1.f / p0->z;
+    iz[1] = 1.f / p1->z;
+    iz[2] = 1.f / p2->z;
+
+    area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+
+    /*
+     *    Occluders hide things whichever way they face, so wind every
+     *    triangle the same way.
+     */
+    if (area < 0.f) {
+        t     = x[1];
+        x[1]  = x[2];
+        x[2]  = t;
+        t     = y[1];
+        y[1]  = y[2];
+        y[2]  = t;
+        t     = iz[1];
+        iz[1] = iz[2];
+        iz[2] = t;
+        area  = -area;
+    }
+
+    if (area < 1e-6f)
+        return;
+
+    /*
+     *    The edge functions, e_i(x, y) = a_i * x + b_i * y + c_i, are
+     *    positive on the inside, and each one is the weight of the
+     *    vertex opposite of its edge.
+     */
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        int k = (i + 2) % 3;
+
+        a[i] = y[j] - y[k];
+        b[i] = x[k] - x[j];
+        c[i] = x[j] * y[k] - x[k] * y[j];
+    }
+
+    dzdx   = (a[0] * iz[0] + a[1] * iz[1] + a[2] * iz[2]) / area;
+    dzdy   = (b[0] * iz[0] + b[1] * iz[1] + b[2] * iz[2]) / area;
+    slack  = (fabsf(dzdx) + fabsf(dzdy)) / 2;
+    iz_min = MIN(MIN(iz[0], iz[1]), iz[2]);
+
+    x0 = MAX((int)floorf(MIN(MIN(x[0], x[1]), x[2])), 0);
+    y0 = MAX((int)floorf(MIN(MIN(y[0], y[1]), y[2])), 0);
+    x1 = MIN((int)ceilf(MAX(MAX(x[0], x[1]), x[2])), OCCLUSION_WIDTH);
+    y1 = MIN((int)ceilf(MAX(MAX(y[0], y[1]), y[2])), OCCLUSION_HEIGHT);
+
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            float cx = px + 0.5f;
+            float cy = py + 0.5f;
+            float e0 = a[0] * cx + b[0] * cy + c[0];
+            float e1 = a[1] * cx + b[1] * cy + c[1];
+            float e2 = a[2] * cx + b[2] * cy + c[2];
+
+            /*
+             *    A pixel is covered entirely when its worst corner is
+             *    inside of every edge.
+             */
+            if (e0 < (fabsf(a[0]) + fabsf(b[0])) / 2 ||
+                e1 < (fabsf(a[1]) + fabsf(b[1])) / 2 ||
+                e2 < (fabsf(a[2]) + fabsf(b[2])) / 2)
+                continue;
+
+            z = MAX((e0 * iz[0] + e1 * iz[1] + e2 * iz[2]) / area - slack, iz_min);
+            z = 1.f / z;
+
+            if (z < _occlusion_depth[px + py * OCCLUSION_WIDTH])
+                _occlusion_depth[px + py * OCCLUSION_WIDTH] = z;
+        }
+    }
+}
+
+/*
+ *    Cuts a triangle against the near plane, and rasterizes what is
+ *    left of it into the occlusion buffer.
+ *
+ *    @param vec4_t *p0    The first position, in clip space.
+ *    @param vec4_t *p1    The second position, in clip space.
+ *    @param vec4_t *p2    The third position, in clip space.
+ */
+static void occlusion_draw_triangle(vec4_t *p0, vec4_t *p1, vec4_t *p2) {
+    vec4_t *in[3] = {p0, p1, p2};
+    vec4_t  out[4];
+    int     count = 0;
+    float   d0;
+    float   d1;
+    float   t;
+
+    if (p0->z >= _clip_near && p1->z >= _clip_near && p2->z >= _clip_near) {
+        occlusion_rasterize_triangle(p0, p1, p2);
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        vec4_t *a = in[i];
+        vec4_t *b = in[(i + 1) % 3];
+
+        d0 = a->z - _clip_near;
+        d1 = b->z - _clip_near;
+
+        if (d0 >= 0.f)
+            out[count++] = *a;
+
+        if ((d0 >= 0.f) != (d1 >= 0.f)) {
+            t            = d0 / (d0 - d1);
+            out[count].x = a->x + (b->x - a->x) * t;
+            out[count].y = a->y + (b->y - a->y) * t;
+            out[count].z = _clip_near;
+            out[count].w = a->w + (b->w - a->w) * t;
+            count++;
+        }
+    }
+
+    for (int i = 1; i + 1 < count; i++) {
+        occlusion_rasterize_triangle(&out[0], &out[i], &out[i + 1]);
+    }
+}
+
+/*
+ *    Rasterizes an occluder into the occlusion buffer.
+ *
+ *    @param mesh_t *mesh    The occluder.
+ */
+static void occlusion_draw_occluder(mesh_t *mesh) {
+    vbuffer_t     *buf = mesh->vbuf;
+    ibuffer_t     *ibuf = mesh->ibuf;
+    u32            count;
+    u32            end;
+    u32            i0;
+    u32            i1;
+    u32            i2;
+    unsigned char  out[VERTEX_ASM_MAX_VERTEX_SIZE];
+    vec4_t        *p;
+
+    if (buf == (vbuffer_t *)0x0 || mesh->surfaces == (mesh_surface_t *)0x0)
+        return;
+
+    count = buf->size / buf->stride;
+
+    if (count > _occluder_positions_size) {
+        p = realloc(_occluder_positions, count * sizeof(vec4_t));
+
+        if (p == (vec4_t *)0x0) {
+            LOGF_ERR("Could not allocate occluder positions.\n");
+            return;
+        }
+
+        _occluder_positions      = p;
+        _occluder_positions_size = count;
+    }
+
+    /*
+     *    Occluders are small, so every vertex is shaded once up front,
+     *    keeping only its position.
+     */
+    vertexasm_set_layout(buf->layout);
+
+    for (u32 i = 0; i < count; i++) {
+        if (buf->layout.v_fun != (void *)0x0) {
+            memcpy(out, buf->buf + i * buf->stride, buf->stride);
+            buf->layout.v_fun(out, buf->buf + i * buf->stride, mesh->assets);
+            _occluder_positions[i] = vertex_get_position(out);
+        } else {
+            _occluder_positions[i] = vertex_get_position(buf->buf + i * buf->stride);
+        }
+    }
+
+    p = _occluder_positions;
+
+    for (u32 s = 0; s < mesh->surface_count; s++) {
+        mesh_surface_t *surface = &mesh->surfaces[s];
+
+        end = surface->offset + surface->size;
+        end = MIN(end, ibuf != (ibuffer_t *)0x0 ? ibuf->count : count);
+
+        for (u32 i = surface->offset; i + 2 < end; i += 3) {
+            i0 = ibuf != (ibuffer_t *)0x0 ? ibuf->buf[i + 0] : i + 0;
+            i1 = ibuf != (ibuffer_t *)0x0 ? ibuf->buf[i + 1] : i + 1;
+            i2 = ibuf != (ibuffer_t *)0x0 ? ibuf->buf[i + 2] : i + 2;
+
+            if (i0 >= count || i1 >= count || i2 >= count) {
+                LOGF_ERR("Index out of range of the vertex buffer.\n");
+                return;
+            }
+
+            occlusion_draw_triangle(&p[i0], &p[i1], &p[i2]);
+        }
+    }
+}
+
+/*
+ *    Clears the occlusion buffer, and rasterizes every occluder into it.
+ */
+void occlusion_render(void) {
+    _occlusion_ready = _occluder_count > 0;
+
+    if (!_occlusion_ready)
+        return;
+
+    /*
+     *    Pixels no occluder covers must never hide anything, however
+     *    far the camera lets boxes be.
+     */
+    for (u32 i = 0; i < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; i++) {
+        _occlusion_depth[i] = INFINITY;
+    }
+
+    for (u32 i = 0; i < _occluder_count; i++) {
+        occlusion_draw_occluder(_occluders[i]);
+    }
+}
+
+/*
+ *    Checks whether a box is hidden behind the occluders.
+ *
+ *    @param vec4_t *corners    The eight corners of the box, in clip space.
+ *
+ *    @return unsigned int      1 if the box is hidden, 0 otherwise.
+ */
+unsigned int occlusion_box_occluded(vec4_t *corners) {
+    float x0    = 1.f;
+    float y0    = 1.f;
+    float x1    = -1.f;
+    float y1    = -1.f;
+    float depth = corners[0].z;
+    int   px0;
+    int   py0;
+    int   px1;
+    int   py1;
+
+    if (!_occlusion_ready)
+        return 0;
+
+    /*
+     *    Boxes reaching behind the near plane cover the screen in ways
+     *    that are not worth working out.
+     */
+    for (u32 i = 0; i < 8; i++) {
+        if (corners[i].z < _clip_near || corners[i].w <= 0.f)
+            return 0;
+
+        x0    = MIN(x0, corners[i].x / corners[i].w);
+        y0    = MIN(y0, corners[i].y / corners[i].w);
+        x1    = MAX(x1, corners[i].x / corners[i].w);
+        y1    = MAX(y1, corners[i].y / corners[i].w);
+        depth = MIN(depth, corners[i].z);
+    }
+
+    px0 = MAX((int)floorf((x0 + 1.0f) * OCCLUSION_WIDTH / 2), 0);
+    py0 = MAX((int)floorf((y0 + 1.0f) * OCCLUSION_HEIGHT / 2), 0);
+    px1 = MIN((int)ceilf((x1 + 1.0f) * OCCLUSION_WIDTH / 2), OCCLUSION_WIDTH);
+    py1 = MIN((int)ceilf((y1 + 1.0f) * OCCLUSION_HEIGHT / 2), OCCLUSION_HEIGHT);
+
+    if (px0 >= px1 || py0 >= py1)
+        return 0;
+
+    /*
+     *    A box lying right on an occluder, as the occluder's own does,
+     *    is kept.
+     */
+    for (int y = py0; y < py1; y++) {
+        for (int x = px0; x < px1; x++) {
+            if (depth <= _occlusion_depth[x + y * OCCLUSION_WIDTH])
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ *    Frees the memory used by occlusion culling.
+ */
+void occlusion_free(void) {
+    free(_occluder_positions);
+
+    _occluder_positions      = (vec4_t *)0x0;
+    _occluder_positions_size = 0;
+    _occluder_count          = 0;
+    _occlusion_ready         = 0;
+}
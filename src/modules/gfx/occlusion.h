@@ -0,0 +1,61 @@
+/*
+ *    occlusion.h    --    header for software occlusion culling
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    Occluders are simple meshes, such as the walls and floors of a
+ *    level, that hide much of what is behind them. At the start of a
+ *    render group they are rasterized, depth only, into a small buffer
+ *    of their own, and the boxes of meshes about to be drawn are tested
+ *    against it, so that hidden meshes are thrown away before any of
+ *    their vertices are shaded.
+ *
+ *    The buffer is filled conservatively, a pixel only takes an
+ *    occluder's depth if the occluder covers all of it, and then only
+ *    the farthest depth the occluder has inside of it.
+ */
+#ifndef CHIK_GFX_OCCLUSION_H
+#define CHIK_GFX_OCCLUSION_H
+
+#include "libchik.h"
+
+#define OCCLUSION_WIDTH         256
+#define OCCLUSION_HEIGHT        128
+#define OCCLUSION_MAX_OCCLUDERS 256
+
+/*
+ *    Adds a mesh to the occluders. Its vertex shader and assets should
+ *    place it in clip space as they would when drawing it, by the time
+ *    the next render group begins.
+ *
+ *    @param void *m    The mesh.
+ */
+void occlusion_add_occluder(void *m);
+
+/*
+ *    Removes a mesh from the occluders.
+ *
+ *    @param void *m    The mesh.
+ */
+void occlusion_remove_occluder(void *m);
+
+/*
+ *    Clears the occlusion buffer, and rasterizes every occluder into it.
+ */
+void occlusion_render(void);
+
+/*
+ *    Checks whether a box is hidden behind the occluders.
+ *
+ *    @param vec4_t *corners    The eight corners of the box, in clip space.
+ *
+ *    @return unsigned int      1 if the box is hidden, 0 otherwise.
+ */
+unsigned int occlusion_box_occluded(vec4_t *corners);
+
+/*
+ *    Frees the memory used by occlusion culling.
+ */
+void occlusion_free(void);
+
+#endif /* CHIK_GFX_OCCLUSION_H  */
@@ -9,34 +9,49 @@
  */
 #include "raster.h"
 
+#include <math.h>
+
+#include "depth.h"
+#include "halfspace.h"
+#include "hiz.h"
 #include "vertexasm.h"
+#include "visbuf.h"
 
 rendertarget_t *_raster_target;
 
-rendertarget_t *_z_buffer;
+depthbuffer_t  *_z_buffer;
+depth_fmt_e     _z_format = DEPTH_FMT_F32;
+
+unsigned int    _fast_clear        = 0;
+unsigned int    _hiz_wanted        = 0;
+unsigned char  *_clear_tiles       = nullptr;
+u32             _clear_cols        = 0;
+u32             _clear_rows        = 0;
+unsigned int    _clear_color_value = 0;
+
+void (*raster_triangle_func)(void *, void *, void *, void *, material_t *, raster_rect_t *) = raster_rasterize_triangle_scanline;
 
-extern v_layout_t _layout;
+THREAD_LOCAL raster_pass_e _raster_pass        = RASTER_PASS_FULL;
+THREAD_LOCAL u32           _raster_triangle_id = 0;
+
+extern THREAD_LOCAL v_layout_t _layout;
 
 /*
  *    Sets up the rasterization stage.
  */
 void raster_setup(void) {
-    unsigned int width;
-    unsigned int height;
-
-    if (args_has("-w") && args_has("-h")) {
-        width  = args_get_int("-w");
-        height = args_get_int("-h");
+    if (args_has("--depth-unorm16")) {
+        _z_format = DEPTH_FMT_UNORM16;
+    } else if (args_has("--depth-unorm24")) {
+        _z_format = DEPTH_FMT_UNORM24;
     } else {
-        width  = 1152;
-        height = 864;
+        _z_format = DEPTH_FMT_F32;
     }
 
-    _z_buffer = rendertarget_create(width, height, IMAGE_FMT_RGBA8);
-
-    if (!_z_buffer) {
-        LOGF_FAT("Could not create Z buffer.");
-        return;
+    if (args_has("--halfspace-raster")) {
+        raster_triangle_func = halfspace_rasterize_triangle;
+    } else {
+        raster_triangle_func = raster_rasterize_triangle_scanline;
     }
 }
 
@@ -57,18 +72,250 @@ void raster_set_vertex_layout(v_layout_t layout) {
  */
 void raster_set_rendertarget(rendertarget_t *target) {
     _raster_target = target;
+
+    /*
+     *    The depth buffer always matches the size of what is drawn to.
+     */
+    if (_z_buffer != (depthbuffer_t *)0x0 &&
+        _z_buffer->width == target->target->width && _z_buffer->height == target->target->height)
+        return;
+
+    depthbuffer_free(_z_buffer);
+
+    _z_buffer = depthbuffer_create(target->target->width, target->target->height, _z_format);
+
+    if (_z_buffer == (depthbuffer_t *)0x0) {
+        LOGF_FAT("Could not create Z buffer.");
+        return;
+    }
+
+    if (_hiz_wanted && !hiz_init(_z_buffer->width, _z_buffer->height)) {
+        LOGF_ERR("Could not create hierarchical Z buffer, continuing without it.\n");
+    }
+
+    free(_clear_tiles);
+
+    _clear_cols  = (_z_buffer->width + RASTER_CLEAR_TILE_SIZE - 1) / RASTER_CLEAR_TILE_SIZE;
+    _clear_rows  = (_z_buffer->height + RASTER_CLEAR_TILE_SIZE - 1) / RASTER_CLEAR_TILE_SIZE;
+    _clear_tiles = calloc(_clear_cols * _clear_rows, 1);
+
+    if (_clear_tiles == (unsigned char *)0x0) {
+        LOGF_ERR("Could not allocate clear tiles, continuing without fast clears.\n");
+        _fast_clear = 0;
+    }
+}
+
+/*
+ *    Returns a rectangle covering the whole render target.
+ *
+ *    @return raster_rect_t    The render target's rectangle.
+ */
+raster_rect_t raster_get_target_rect(void) {
+    raster_rect_t rect = {
+        .x0 = 0,
+        .y0 = 0,
+        .x1 = _raster_target->target->width,
+        .y1 = _raster_target->target->height,
+    };
+
+    return rect;
 }
 
 /*
  *    Clears the depth buffer.
  */
 void raster_clear_depth(void) {
-    size_t i;
-    float        *pDepth = (float *)_z_buffer->target->buf;
+    u32 i;
+
+    if (_fast_clear) {
+        depthbuffer_begin_clear(_z_buffer);
 
-    for (i = 0; i < _z_buffer->target->width * _z_buffer->target->height; i++) {
-        pDepth[i] = 1000.f;
+        for (i = 0; i < _clear_cols * _clear_rows; i++) {
+            _clear_tiles[i] |= RASTER_CLEAR_DEPTH;
+        }
+    } else {
+        depthbuffer_clear(_z_buffer);
     }
+
+    hiz_clear(depth_decode(_z_buffer, _z_buffer->clear));
+}
+
+/*
+ *    Clears the depth of a rectangle of the render target, on the
+ *    calling thread. With fast clears, clear tiles the rectangle
+ *    covers whole are only marked.
+ *
+ *    @param raster_rect_t *rect    The rectangle.
+ */
+void raster_clear_depth_rect(raster_rect_t *rect) {
+    u32 tx;
+    u32 ty;
+    int x0 = MAX(rect->x0, 0);
+    int y0 = MAX(rect->y0, 0);
+    int x1 = MIN(rect->x1, (int)_z_buffer->width);
+    int y1 = MIN(rect->y1, (int)_z_buffer->height);
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (!_fast_clear || x0 % RASTER_CLEAR_TILE_SIZE || y0 % RASTER_CLEAR_TILE_SIZE ||
+        (x1 % RASTER_CLEAR_TILE_SIZE && x1 != (int)_z_buffer->width) ||
+        (y1 % RASTER_CLEAR_TILE_SIZE && y1 != (int)_z_buffer->height)) {
+        raster_touch_rect(rect);
+        depthbuffer_clear_rect(_z_buffer, x0, y0, x1, y1);
+        return;
+    }
+
+    for (ty = y0 / RASTER_CLEAR_TILE_SIZE; ty <= (u32)(y1 - 1) / RASTER_CLEAR_TILE_SIZE; ty++) {
+        for (tx = x0 / RASTER_CLEAR_TILE_SIZE; tx <= (u32)(x1 - 1) / RASTER_CLEAR_TILE_SIZE; tx++) {
+            _clear_tiles[tx + ty * _clear_cols] |= RASTER_CLEAR_DEPTH;
+        }
+    }
+}
+
+/*
+ *    Clears the render target to a color.
+ *
+ *    @param unsigned int color    The color.
+ */
+void raster_clear_color(unsigned int color) {
+    u32 i;
+
+    if (!_fast_clear) {
+        image_clear(_raster_target->target, color);
+        return;
+    }
+
+    _clear_color_value = color;
+
+    for (i = 0; i < _clear_cols * _clear_rows; i++) {
+        _clear_tiles[i] |= RASTER_CLEAR_COLOR;
+    }
+}
+
+/*
+ *    Turns fast clears on or off. They may only be on while no two
+ *    workers draw to the same clear tile at once.
+ *
+ *    @param unsigned int enabled    Whether to use fast clears.
+ */
+void raster_enable_fast_clear(unsigned int enabled) {
+    /*
+     *    Nothing may be left marked when switching to eager clears.
+     */
+    if (!enabled && _fast_clear) {
+        raster_resolve_color();
+        raster_touch_rect(&(raster_rect_t){0, 0, _z_buffer->width, _z_buffer->height});
+    }
+
+    _fast_clear = enabled && _clear_tiles != (unsigned char *)0x0;
+}
+
+/*
+ *    Turns the hierarchical depth buffer on or off. It may only be on
+ *    while no two threads read or write the same tile at once.
+ *
+ *    @param unsigned int enabled    Whether to use it.
+ */
+void raster_enable_hiz(unsigned int enabled) {
+    _hiz_wanted = enabled;
+
+    if (!enabled) {
+        hiz_free();
+        return;
+    }
+
+    if (_hiz.enabled || _z_buffer == (depthbuffer_t *)0x0)
+        return;
+
+    if (!hiz_init(_z_buffer->width, _z_buffer->height)) {
+        LOGF_ERR("Could not create hierarchical Z buffer, continuing without it.\n");
+        _hiz_wanted = 0;
+    }
+}
+
+/*
+ *    Fills the marked parts of a clear tile.
+ *
+ *    @param u32           tx       The tile's column.
+ *    @param u32           ty       The tile's row.
+ *    @param unsigned char flags    The RASTER_CLEAR_* parts to fill.
+ */
+static void raster_fill_tile(u32 tx, u32 ty, unsigned char flags) {
+    u32 x0 = tx * RASTER_CLEAR_TILE_SIZE;
+    u32 y0 = ty * RASTER_CLEAR_TILE_SIZE;
+    u32 x1 = MIN(x0 + RASTER_CLEAR_TILE_SIZE, _z_buffer->width);
+    u32 y1 = MIN(y0 + RASTER_CLEAR_TILE_SIZE, _z_buffer->height);
+
+    if (flags & RASTER_CLEAR_COLOR)
+        image_clear_rect(_raster_target->target, _clear_color_value, x0, y0, x1, y1);
+
+    if (flags & RASTER_CLEAR_DEPTH)
+        depthbuffer_clear_rect(_z_buffer, x0, y0, x1, y1);
+
+    _clear_tiles[tx + ty * _clear_cols] &= ~flags;
+}
+
+/*
+ *    Fills the cleared tiles a rectangle touches, before it is drawn to.
+ *
+ *    @param raster_rect_t *rect    The rectangle.
+ */
+void raster_touch_rect(raster_rect_t *rect) {
+    u32 tx;
+    u32 ty;
+    int x0 = MAX(rect->x0, 0);
+    int y0 = MAX(rect->y0, 0);
+    int x1 = MIN(rect->x1, (int)_z_buffer->width);
+    int y1 = MIN(rect->y1, (int)_z_buffer->height);
+
+    if (!_fast_clear || x0 >= x1 || y0 >= y1)
+        return;
+
+    for (ty = y0 / RASTER_CLEAR_TILE_SIZE; ty <= (u32)(y1 - 1) / RASTER_CLEAR_TILE_SIZE; ty++) {
+        for (tx = x0 / RASTER_CLEAR_TILE_SIZE; tx <= (u32)(x1 - 1) / RASTER_CLEAR_TILE_SIZE; tx++) {
+            if (_clear_tiles[tx + ty * _clear_cols])
+                raster_fill_tile(tx, ty, _clear_tiles[tx + ty * _clear_cols]);
+        }
+    }
+}
+
+/*
+ *    Fills every cleared tile of the render target, so that it can be
+ *    presented. Depth is left until it is drawn to.
+ */
+void raster_resolve_color(void) {
+    u32 tx;
+    u32 ty;
+
+    if (!_fast_clear)
+        return;
+
+    for (ty = 0; ty < _clear_rows; ty++) {
+        for (tx = 0; tx < _clear_cols; tx++) {
+            if (_clear_tiles[tx + ty * _clear_cols] & RASTER_CLEAR_COLOR)
+                raster_fill_tile(tx, ty, RASTER_CLEAR_COLOR);
+        }
+    }
+}
+
+/*
+ *    Sets the pass triangles are rasterized in, on the calling thread.
+ *
+ *    @param raster_pass_e pass    The pass.
+ */
+void raster_set_pass(raster_pass_e pass) {
+    _raster_pass = pass;
+}
+
+/*
+ *    Sets the id the visibility pass records for the triangles it
+ *    rasterizes next, on the calling thread.
+ *
+ *    @param u32 id    The triangle id.
+ */
+void raster_set_triangle_id(u32 id) {
+    _raster_triangle_id = id;
 }
 
 /*
@@ -79,8 +326,9 @@ void raster_clear_depth(void) {
  *    @param int y           The screen y coordinate of the scanline.
  *    @param void *v1        The first vertex of the scanline.
  *    @param void *v2        The second vertex of the scanline.
+ *    @param raster_rect_t *rect    The rectangle to restrict drawing to.
  */
-void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *assets, material_t *mat) {
+void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *assets, material_t *mat, raster_rect_t *rect) {
     int        x = 0;
     int        end_x = 0;
     int        temp = 0;
@@ -88,8 +336,12 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
     float      iz = 0.f;
     float      z = 0.f;
     float      dz = 0.f;
-    float     *depth = nullptr;
+    u32        depth = 0;
+    u32        key = 0;
+    u32        stored = 0;
     char      *raster = nullptr;
+    int        start_x = 0;
+    int        written = 0;
     vec_t     *tempv = nullptr;
     vec4_t     p1;
     vec4_t     p2;
@@ -98,14 +350,15 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
     vec_t      diff[MAX_VECTOR_ATTRIBUTES];
     fragment_t f;
     void (*f_fun)(fragment_t *, void *, void *, material_t *) = _layout.f_fun;
-    void (*v_scale)(void *, void *, float) = _layout.v_scale;
-    void (*v_add)(void *, void *, void *) = _layout.v_add;
+    void (*v_scale)(void *, void *, float) = _layout_info.v_scale;
+    void (*v_add)(void *, void *, void *) = _layout_info.v_add;
+    raster_pass_e pass = _raster_pass;
 
     /*
      *    Early out if the scanline is outside the render target,
      *    or if the line is a degenerate.
      */
-    if (y < 0 || y >= _raster_target->target->height || (x1 < 0 && x2 < 0)) {
+    if (y < rect->y0 || y >= rect->y1 || (x1 < rect->x0 && x2 < rect->x0)) {
         return;
     }
 
@@ -119,6 +372,10 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
         v2    = tempv;
     }
 
+    if (x1 >= x2 || x2 <= rect->x0 || x1 >= rect->x1) {
+        return;
+    }
+
     p1 = vertex_get_position(v1);
     p2 = vertex_get_position(v2);
 
@@ -129,24 +386,38 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
     f.pos.x = x;
     f.pos.y = y;
 
-    x      = MAX(x1, 0);
-    z      = p1.z;
-    dz     = (p2.z - p1.z) / (x2 - x1);
-    width  = _raster_target->target->width;
-    depth  = (float *)_z_buffer->target->buf + x + y * width;
-    raster = _raster_target->target->buf + (y * width + x) * 3;
-    end_x  = MIN(x2, width);
+    x       = MAX(x1, rect->x0);
+    start_x = x;
+    dz      = (p2.z - p1.z) / (x2 - x1);
+    z       = p1.z + dz * (x - x1);
+    width   = _raster_target->target->width;
+    depth   = x + y * width;
+    raster  = _raster_target->target->buf + (y * width + x) * 3;
+    end_x   = MIN(x2, rect->x1);
 
     /*
-     *    Build the differential.
+     *    Build the differential, and step the starting vertex up to the
+     *    first pixel inside of the rectangle.
      */
     vertex_build_differential(diff, v1, v2, 1.0 / (x2 - x1));
-    memcpy(&v, v1, sizeof(v));
+
+    if (x > x1) {
+        memcpy(&v, vertex_build_interpolated(v1, v2, (float)(x - x1) / (x2 - x1)), sizeof(v));
+    } else {
+        memcpy(&v, v1, sizeof(v));
+    }
 
     while (x < end_x) {
-        iz = 1.0f / z;
+        iz     = 1.0f / z;
+        key    = depth_encode(_z_buffer, iz);
+        stored = depth_load(_z_buffer, depth);
 
-        if (*depth <= iz) {
+        /*
+         *    The shading pass runs the same arithmetic as the depth
+         *    pass did, so the visible triangle matches the depth buffer
+         *    exactly.
+         */
+        if (pass == RASTER_PASS_SHADE ? stored != key : stored <= key) {
             /*
              *    Interpolate the vector values, and apply to the fragment.
              */
@@ -159,15 +430,24 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
             continue;   
         }
 
-        *depth = iz;
+        if (pass != RASTER_PASS_SHADE) {
+            depth_store(_z_buffer, depth, key);
+            written = 1;
+        }
 
-        v_scale(&scaled_v, &v, iz);
-        f_fun(&f, &scaled_v, assets, mat);
+        if (pass == RASTER_PASS_VISIBILITY) {
+            _visbuf[x + y * width] = _raster_triangle_id;
+        }
 
-        /*
-         *    Draw the vertex.
-         */
-        memcpy(raster, &f.color, 3);
+        if (pass == RASTER_PASS_FULL || pass == RASTER_PASS_SHADE) {
+            v_scale(&scaled_v, &v, iz);
+            f_fun(&f, &scaled_v, assets, mat);
+
+            /*
+             *    Draw the vertex.
+             */
+            memcpy(raster, &f.color, 3);
+        }
 
         /*
          *    Interpolate the vector values, and apply to the fragment.
@@ -179,8 +459,12 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
         depth++;
         x++;
     }
+
+    if (written)
+        hiz_mark_span(start_x, end_x, y);
 }
 
+
 /*
  *    Rasterizes a single triangle.
  *
@@ -189,6 +473,65 @@ void raster_draw_scanline(int x1, int x2, int y, void *v1, void *v2, void *asset
  *    @param void *v2        The raw vertex data for the third vertex.
  */
 void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, material_t *mat) {
+    raster_rect_t rect = raster_get_target_rect();
+
+    raster_rasterize_triangle_rect(r0, r1, r2, assets, mat, &rect);
+}
+
+/*
+ *    Rasterizes a single triangle, only touching pixels inside of a rectangle.
+ *
+ *    @param void *v0              The raw vertex data for the first vertex.
+ *    @param void *v1              The raw vertex data for the second vertex.
+ *    @param void *v2              The raw vertex data for the third vertex.
+ *    @param raster_rect_t *rect   The rectangle to restrict drawing to.
+ */
+void raster_rasterize_triangle_rect(void *r0, void *r1, void *r2, void *assets, material_t *mat, raster_rect_t *rect) {
+    raster_rect_t bounds;
+    vec4_t        p0;
+    vec4_t        p1;
+    vec4_t        p2;
+    int           width;
+    int           height;
+    unsigned int  hiz = _hiz.enabled && _raster_pass != RASTER_PASS_SHADE;
+
+    if (hiz || _fast_clear) {
+        p0     = vertex_get_position(r0);
+        p1     = vertex_get_position(r1);
+        p2     = vertex_get_position(r2);
+        width  = _raster_target->target->width;
+        height = _raster_target->target->height;
+
+        bounds.x0 = MAX((int)floorf((MIN(MIN(p0.x, p1.x), p2.x) + 1.0f) * width / 2), rect->x0);
+        bounds.y0 = MAX((int)floorf((MIN(MIN(p0.y, p1.y), p2.y) + 1.0f) * height / 2), rect->y0);
+        bounds.x1 = MIN((int)ceilf((MAX(MAX(p0.x, p1.x), p2.x) + 1.0f) * width / 2) + 1, rect->x1);
+        bounds.y1 = MIN((int)ceilf((MAX(MAX(p0.y, p1.y), p2.y) + 1.0f) * height / 2) + 1, rect->y1);
+
+        /*
+         *    Throw away triangles that are hidden behind what has
+         *    already been drawn everywhere they would land. While
+         *    shading after a prepass, the visible triangles sit right
+         *    at the tiles' bounds, so nothing is rejected.
+         */
+        if (hiz && hiz_rect_occluded(&bounds, MIN(MIN(p0.z, p1.z), p2.z)))
+            return;
+
+        raster_touch_rect(&bounds);
+    }
+
+    raster_triangle_func(r0, r1, r2, assets, mat, rect);
+}
+
+/*
+ *    Rasterizes a single triangle scanline by scanline, only touching
+ *    pixels inside of a rectangle.
+ *
+ *    @param void *v0              The raw vertex data for the first vertex.
+ *    @param void *v1              The raw vertex data for the second vertex.
+ *    @param void *v2              The raw vertex data for the third vertex.
+ *    @param raster_rect_t *rect   The rectangle to restrict drawing to.
+ */
+void raster_rasterize_triangle_scanline(void *r0, void *r1, void *r2, void *assets, material_t *mat, raster_rect_t *rect) {
     /*
      *    Extract position data and rasterize it.
      */
@@ -199,17 +542,17 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
     /*
      *    Map the normalized coordinates to screen coordinates.
      */
-    vec2u_t v1 = {
-        .x = (unsigned int)((p1.x + 1.0f) * _raster_target->target->width / 2),
-        .y = (unsigned int)((p1.y + 1.0f) * _raster_target->target->height / 2),
+    raster_point_t v1 = {
+        .x = (int)floorf((p1.x + 1.0f) * _raster_target->target->width / 2),
+        .y = (int)floorf((p1.y + 1.0f) * _raster_target->target->height / 2),
     };
-    vec2u_t v2 = {
-        .x = (unsigned int)((p2.x + 1.0f) * _raster_target->target->width / 2),
-        .y = (unsigned int)((p2.y + 1.0f) * _raster_target->target->height / 2),
+    raster_point_t v2 = {
+        .x = (int)floorf((p2.x + 1.0f) * _raster_target->target->width / 2),
+        .y = (int)floorf((p2.y + 1.0f) * _raster_target->target->height / 2),
     };
-    vec2u_t v3 = {
-        .x = (unsigned int)((p3.x + 1.0f) * _raster_target->target->width / 2),
-        .y = (unsigned int)((p3.y + 1.0f) * _raster_target->target->height / 2),
+    raster_point_t v3 = {
+        .x = (int)floorf((p3.x + 1.0f) * _raster_target->target->width / 2),
+        .y = (int)floorf((p3.y + 1.0f) * _raster_target->target->height / 2),
     };
 
     unsigned char v0[VERTEX_ASM_MAX_VERTEX_SIZE];
@@ -233,7 +576,7 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
     float z2 = p2.z;
     float z3 = p3.z;
 
-    vec2u_t temp;
+    raster_point_t temp;
     float   tempf;
     void   *pTemp;
 
@@ -290,10 +633,10 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
     }
 
     /*
-     *    Rasterize the starting y position.
+     *    Rasterize the starting y position, and the last row we will touch.
      */
-    int y = MAX(v1.y, 0);
-    y     = MIN(y, _raster_target->target->height);
+    int y     = MIN((int)v1.y, rect->y1 - 1);
+    int y_end = MAX((int)v3.y, rect->y0);
 
     /*
      *    Calculate the slopes of the lines.
@@ -351,7 +694,7 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
             memcpy(pIA, pIB, VERTEX_ASM_MAX_VERTEX_SIZE);
             memcpy(pIB, swap, VERTEX_ASM_MAX_VERTEX_SIZE);
         }
-        while (y >= v3.y) {
+        while (y >= y_end) {
             memcpy(v0,
                    vertex_build_interpolated(pIB, pIC,
                                              (float)(v1.y - y) / (v1.y - v3.y)),
@@ -361,7 +704,7 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
                                              (float)(v1.y - y) / (v1.y - v3.y)),
                    VERTEX_ASM_MAX_VERTEX_SIZE);
             raster_draw_scanline(v2.x + (y - v1.y) * dy2,
-                                 v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat);
+                                 v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat, rect);
             y--;
         }
         return;
@@ -392,7 +735,7 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
             memcpy(pIB, pIC, VERTEX_ASM_MAX_VERTEX_SIZE);
             memcpy(pIC, swap, VERTEX_ASM_MAX_VERTEX_SIZE);
         }
-        while (y >= v3.y) {
+        while (y >= y_end) {
             memcpy(v0,
                    vertex_build_interpolated(pIA, pIB,
                                              (float)(v1.y - y) / (v1.y - v3.y)),
@@ -402,13 +745,13 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
                                              (float)(v1.y - y) / (v1.y - v3.y)),
                    VERTEX_ASM_MAX_VERTEX_SIZE);
             raster_draw_scanline(v1.x + (y - v1.y) * dy0,
-                                 v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat);
+                                 v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat, rect);
             y--;
         }
         return;
     }
 
-    while (y >= v3.y) {
+    while (y >= y_end) {
         /*
          *    Bend is on the left.
          */
@@ -423,14 +766,14 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
                            pIA, pIB, (float)(v1.y - y) / (v1.y - v2.y)),
                        VERTEX_ASM_MAX_VERTEX_SIZE);
                 raster_draw_scanline(v1.x + (y - v1.y) * dy0,
-                                     v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat);
+                                     v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat, rect);
             } else {
                 memcpy(v0,
                        vertex_build_interpolated(
                            pIB, pIC, (float)(v2.y - y) / (v2.y - v3.y)),
                        VERTEX_ASM_MAX_VERTEX_SIZE);
                 raster_draw_scanline(v2.x + (y - v2.y) * dy2,
-                                     v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat);
+                                     v1.x + (y - v1.y) * dy1, y, v0, v, assets, mat, rect);
             }
         }
         /*
@@ -447,14 +790,14 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
                            pIA, pIB, (float)(v1.y - y) / (v1.y - v2.y)),
                        VERTEX_ASM_MAX_VERTEX_SIZE);
                 raster_draw_scanline(v1.x + (y - v1.y) * dy1,
-                                     v1.x + (y - v1.y) * dy0, y, v0, v, assets, mat);
+                                     v1.x + (y - v1.y) * dy0, y, v0, v, assets, mat, rect);
             } else {
                 memcpy(v,
                        vertex_build_interpolated(
                            pIB, pIC, (float)(v2.y - y) / (v2.y - v3.y)),
                        VERTEX_ASM_MAX_VERTEX_SIZE);
                 raster_draw_scanline(v1.x + (y - v1.y) * dy1,
-                                     v2.x + (y - v2.y) * dy2, y, v0, v, assets, mat);
+                                     v2.x + (y - v2.y) * dy2, y, v0, v, assets, mat, rect);
             }
         }
         y--;
@@ -462,17 +805,21 @@ void raster_rasterize_triangle(void *r0, void *r1, void *r2, void *assets, mater
 }
 
 /*
- *    Uses threads to rasterize a triangle.
+ *    Uses threads to rasterize a batch of triangles.
  *
- *    @param void *params     The parameters for the rasterization.
+ *    @param void *params     The triangle_batch_t to rasterize.
  */
-void *raster_rasterize_triangle_thread(void *params) {
-    triangle_t *tri = (triangle_t *)params;
+void *raster_rasterize_batch_thread(void *params) {
+    u32               i;
+    triangle_t       *tri;
+    triangle_batch_t *batch = (triangle_batch_t *)params;
 
-    raster_rasterize_triangle(tri->v0, tri->v1, tri->v2, tri->assets, tri->material);
+    for (i = 0; i < batch->count; i++) {
+        tri = &batch->tris[i];
+
+        vertexasm_bind_layout(tri->layout);
+        raster_rasterize_triangle(tri->v0, tri->v1, tri->v2, tri->assets, tri->material);
+    }
 
-    free(tri->v0);
-    free(tri->v1);
-    free(tri->v2);
-    free(tri);
+    return nullptr;
 }
\ No newline at end of file
@@ -25,8 +25,60 @@ typedef struct {
     void* v2;
     void* assets;
     material_t* material;
+    v_layout_t* layout;
 } triangle_t;
 
+typedef struct {
+    triangle_t* tris;
+    u32         count;
+    u32         capacity;
+} triangle_batch_t;
+
+/*
+ *    A screen-space rectangle, x0/y0 inclusive and x1/y1 exclusive.
+ */
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} raster_rect_t;
+
+/*
+ *    Fast clears only mark tiles of the render target and depth buffer
+ *    as cleared, and the tiles are filled when first drawn to. The
+ *    tiles line up with the bins', so that a tile is only ever filled
+ *    by the worker drawing it.
+ */
+#define RASTER_CLEAR_TILE_SIZE 64
+#define RASTER_CLEAR_COLOR     0x1
+#define RASTER_CLEAR_DEPTH     0x2
+
+/*
+ *    The passes a triangle can be rasterized in. The full pass tests,
+ *    writes and shades as triangles arrive. With a depth prepass, every
+ *    triangle is first rasterized to the depth buffer only, and then
+ *    again shading only the pixels whose depth it matches exactly, so
+ *    that each visible pixel is shaded once. The visibility pass writes
+ *    depth and the visible triangle's id, leaving shading to a later
+ *    pass over the visibility buffer.
+ */
+typedef enum {
+    RASTER_PASS_FULL,
+    RASTER_PASS_DEPTH,
+    RASTER_PASS_SHADE,
+    RASTER_PASS_VISIBILITY,
+} raster_pass_e;
+
+/*
+ *    A screen-space point. Points may lie off of the render target,
+ *    since triangles are only clipped to the guard band.
+ */
+typedef struct {
+    int x;
+    int y;
+} raster_point_t;
+
 /*
  *    Sets up the rasterization stage.
  */
@@ -51,6 +103,65 @@ void raster_set_rendertarget(rendertarget_t *spTarget);
  */
 void raster_clear_depth(void);
 
+/*
+ *    Clears the depth of a rectangle of the render target, on the
+ *    calling thread.
+ *
+ *    @param raster_rect_t *rect    The rectangle.
+ */
+void raster_clear_depth_rect(raster_rect_t *rect);
+
+/*
+ *    Clears the render target to a color.
+ *
+ *    @param unsigned int color    The color.
+ */
+void raster_clear_color(unsigned int color);
+
+/*
+ *    Turns fast clears on or off. They may only be on while no two
+ *    workers draw to the same clear tile at once.
+ *
+ *    @param unsigned int enabled    Whether to use fast clears.
+ */
+void raster_enable_fast_clear(unsigned int enabled);
+
+/*
+ *    Turns the hierarchical depth buffer on or off. It may only be on
+ *    while no two threads read or write the same tile at once.
+ *
+ *    @param unsigned int enabled    Whether to use it.
+ */
+void raster_enable_hiz(unsigned int enabled);
+
+/*
+ *    Fills the cleared tiles a rectangle touches, before it is drawn to.
+ *
+ *    @param raster_rect_t *rect    The rectangle.
+ */
+void raster_touch_rect(raster_rect_t *rect);
+
+/*
+ *    Fills every cleared tile of the render target, so that it can be
+ *    presented.
+ */
+void raster_resolve_color(void);
+
+/*
+ *    Sets the pass triangles are rasterized in, on the calling thread.
+ *
+ *    @param raster_pass_e pass    The pass.
+ */
+void raster_set_pass(raster_pass_e pass);
+
+/*
+ *    Sets the id the visibility pass records for the triangles it
+ *    rasterizes next, on the calling thread.
+ *
+ *    @param u32 id    The triangle id.
+ */
+void raster_set_triangle_id(u32 id);
+
 /*
  *    Check a pixel against the depth buffer.
  *
@@ -62,16 +173,24 @@ void raster_clear_depth(void);
  */
 unsigned int raster_check_depth(unsigned int sX, unsigned int sY, float sDepth);
 
+/*
+ *    Returns a rectangle covering the whole render target.
+ *
+ *    @return raster_rect_t    The render target's rectangle.
+ */
+raster_rect_t raster_get_target_rect(void);
+
 /*
  *    Draw a scanline.
  *
- *    @param int           The screen x coordinate of the start of the scanline.
- *    @param int           The screen x coordinate of the end of the scanline.
- *    @param int           The screen y coordinate of the scanline.
- *    @param void *        The first vertex of the scanline.
- *    @param void *        The second vertex of the scanline.
+ *    @param int             The screen x coordinate of the start of the scanline.
+ *    @param int             The screen x coordinate of the end of the scanline.
+ *    @param int             The screen y coordinate of the scanline.
+ *    @param void *          The first vertex of the scanline.
+ *    @param void *          The second vertex of the scanline.
+ *    @param raster_rect_t * The rectangle to restrict drawing to.
  */
-void raster_draw_scanline(int sX1, int sX2, int sY, void *spV1, void *spV2, void *assets, material_t* mat);
+void raster_draw_scanline(int sX1, int sX2, int sY, void *spV1, void *spV2, void *assets, material_t* mat, raster_rect_t *rect);
 
 /*
  *    Rasterizes a single triangle.
@@ -83,10 +202,31 @@ void raster_draw_scanline(int sX1, int sX2, int sY, void *spV1, void *spV2, void
 void raster_rasterize_triangle(void *spV1, void *spV2, void *spV3, void *assets, material_t* mat);
 
 /*
- *    Uses threads to rasterize a triangle.
+ *    Rasterizes a single triangle, only touching pixels inside of a rectangle.
+ *
+ *    @param void *          The raw vertex data for the first vertex.
+ *    @param void *          The raw vertex data for the second vertex.
+ *    @param void *          The raw vertex data for the third vertex.
+ *    @param raster_rect_t * The rectangle to restrict drawing to.
+ */
+void raster_rasterize_triangle_rect(void *spV1, void *spV2, void *spV3, void *assets, material_t* mat, raster_rect_t *rect);
+
+/*
+ *    Rasterizes a single triangle scanline by scanline, only touching
+ *    pixels inside of a rectangle.
+ *
+ *    @param void *          The raw vertex data for the first vertex.
+ *    @param void *          The raw vertex data for the second vertex.
+ *    @param void *          The raw vertex data for the third vertex.
+ *    @param raster_rect_t * The rectangle to restrict drawing to.
+ */
+void raster_rasterize_triangle_scanline(void *spV1, void *spV2, void *spV3, void *assets, material_t* mat, raster_rect_t *rect);
+
+/*
+ *    Uses threads to rasterize a batch of triangles.
  *
- *    @param void *     The parameters for the rasterization.
+ *    @param void *     The triangle_batch_t to rasterize.
  */
-void *raster_rasterize_triangle_thread(void *spParams);
+void *raster_rasterize_batch_thread(void *spParams);
 
 #endif /* CHIK_GFX_RASTER_H  */
\ No newline at end of file
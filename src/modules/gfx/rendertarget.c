@@ -12,6 +12,7 @@
 #include "gfx.h"
 
 extern vec2u_t (*platform_get_screen_size)(void);
+extern unsigned int (*platform_acquire_image)(image_t *);
 
 rendertarget_t **_render_targets = NULL;
 
@@ -45,6 +46,7 @@ rendertarget_t *rendertarget_create(unsigned int width, unsigned int height, uns
     }
 
     render_target->target = image;
+    render_target->buf    = image->buf;
 
     /*
      *    Make a new list of render targets if there is none.
@@ -91,6 +93,8 @@ void rendertarget_free(rendertarget_t *render_target) {
         return;
     }
 
+    render_target->target->buf = render_target->buf;
+
     image_free(render_target->target);
     free(render_target);
 }
@@ -133,6 +137,19 @@ rendertarget_t *rendertarget_create_backbuffer(void) {
  */
 rendertarget_t *rendertarget_get_backbuffer(void) { return _back_buffer; }
 
+/*
+ *    Points a render target's image at memory lent by the platform, so
+ *    that presenting it needs no copy, or back at its own buffer if the
+ *    platform has none to lend. Memory that is lent stays lent until
+ *    the image is presented.
+ *
+ *    @param rendertarget_t *render_target    The render target.
+ */
+void rendertarget_acquire_platform_image(rendertarget_t *render_target) {
+    if (platform_acquire_image == NULL || !platform_acquire_image(render_target->target))
+        render_target->target->buf = render_target->buf;
+}
+
 /*
  *    Frees all render targets.
  */
@@ -17,6 +17,7 @@
 
 typedef struct {
     image_t *target;
+    void    *buf;       /* The image's own buffer, while it draws into the platform's.  */
 } rendertarget_t;
 
 /*
@@ -65,6 +66,15 @@ rendertarget_t *rendertarget_create_backbuffer(void);
  */
 rendertarget_t *rendertarget_get_backbuffer(void);
 
+/*
+ *    Points a render target's image at memory lent by the platform, so
+ *    that presenting it needs no copy, or back at its own buffer if the
+ *    platform has none to lend.
+ *
+ *    @param rendertarget_t *render_target    The render target.
+ */
+void rendertarget_acquire_platform_image(rendertarget_t *render_target);
+
 /*
  *    Frees all render targets.
  */
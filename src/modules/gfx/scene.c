@@ -0,0 +1,678 @@
+/*
+ *    scene.c    --    source for the scene container
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The hierarchy is a binary tree of boxes, with one instance per
+ *    leaf. Instances are inserted next to the node that grows the
+ *    least by taking them in, and every change refits the boxes on
+ *    the way back up to the root.
+ */
+#include "scene.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera.h"
+#include "cull.h"
+#include "drawable.h"
+
+int           _scene_sort_axis  = 0;
+scene_node_t *_scene_sort_nodes = nullptr;
+
+/*
+ *    Returns the surface area of a box, the cost of a node.
+ *
+ *    @param vec3_t *min    The minimum corner.
+ *    @param vec3_t *max    The maximum corner.
+ *
+ *    @return float         The surface area.
+ */
+static float scene_box_area(vec3_t *min, vec3_t *max) {
+    float x = max->x - min->x;
+    float y = max->y - min->y;
+    float z = max->z - min->z;
+
+    return 2.f * (x * y + y * z + z * x);
+}
+
+/*
+ *    Returns the surface area of the union of two nodes' boxes.
+ *
+ *    @param scene_node_t *a    The first node.
+ *    @param scene_node_t *b    The second node.
+ *
+ *    @return float             The surface area of the union.
+ */
+static float scene_union_area(scene_node_t *a, scene_node_t *b) {
+    vec3_t min = {MIN(a->min.x, b->min.x), MIN(a->min.y, b->min.y), MIN(a->min.z, b->min.z)};
+    vec3_t max = {MAX(a->max.x, b->max.x), MAX(a->max.y, b->max.y), MAX(a->max.z, b->max.z)};
+
+    return scene_box_area(&min, &max);
+}
+
+/*
+ *    Grows the node storage, putting the new nodes on the free list.
+ *
+ *    @param scene_t *scene       The scene.
+ *    @param u32      capacity    The amount of nodes to hold.
+ *
+ *    @return unsigned int        1 if successful, 0 otherwise.
+ */
+static unsigned int scene_node_grow(scene_t *scene, u32 capacity) {
+    scene_node_t *nodes;
+    int          *stack;
+
+    nodes = realloc(scene->nodes, sizeof(scene_node_t) * capacity);
+
+    if (nodes == (scene_node_t *)0x0) {
+        LOGF_ERR("Could not grow scene nodes.\n");
+        return 0;
+    }
+
+    scene->nodes = nodes;
+
+    /*
+     *    A traversal never holds more nodes than there are.
+     */
+    stack = realloc(scene->stack, sizeof(int) * capacity);
+
+    if (stack == (int *)0x0) {
+        LOGF_ERR("Could not grow scene traversal stack.\n");
+        return 0;
+    }
+
+    scene->stack = stack;
+
+    for (u32 i = scene->node_capacity; i < capacity; i++) {
+        scene->nodes[i].parent   = (i + 1 < capacity) ? (int)i + 1 : scene->node_free;
+        scene->nodes[i].left     = SCENE_NULL_NODE;
+        scene->nodes[i].instance = -1;
+    }
+
+    scene->node_free     = scene->node_capacity;
+    scene->node_capacity = capacity;
+
+    return 1;
+}
+
+/*
+ *    Allocates a node, growing the node storage if needed.
+ *
+ *    @param scene_t *scene    The scene.
+ *
+ *    @return int              The node, or SCENE_NULL_NODE on failure.
+ */
+static int scene_node_alloc(scene_t *scene) {
+    int node;
+
+    if (scene->node_free == SCENE_NULL_NODE && !scene_node_grow(scene, MAX(scene->node_capacity * 2, 64)))
+        return SCENE_NULL_NODE;
+
+    node             = scene->node_free;
+    scene->node_free = scene->nodes[node].parent;
+
+    scene->nodes[node].parent   = SCENE_NULL_NODE;
+    scene->nodes[node].left     = SCENE_NULL_NODE;
+    scene->nodes[node].right    = SCENE_NULL_NODE;
+    scene->nodes[node].instance = -1;
+    scene->node_count++;
+
+    return node;
+}
+
+/*
+ *    Hands a node back to the free list.
+ *
+ *    @param scene_t *scene    The scene.
+ *    @param int      node     The node.
+ */
+static void scene_node_release(scene_t *scene, int node) {
+    scene->nodes[node].parent   = scene->node_free;
+    scene->nodes[node].left     = SCENE_NULL_NODE;
+    scene->nodes[node].instance = -1;
+    scene->node_free            = node;
+    scene->node_count--;
+}
+
+/*
+ *    Recomputes the boxes of a node and every node above it.
+ *
+ *    @param scene_t *scene    The scene.
+ *    @param int      node     The node to start from.
+ */
+static void scene_refit(scene_t *scene, int node) {
+    scene_node_t *n;
+    scene_node_t *l;
+    scene_node_t *r;
+
+    while (node != SCENE_NULL_NODE) {
+        n = &scene->nodes[node];
+        l = &scene->nodes[n->left];
+        r = &scene->nodes[n->right];
+
+        n->min.x = MIN(l->min.x, r->min.x);
+        n->min.y = MIN(l->min.y, r->min.y);
+        n->min.z = MIN(l->min.z, r->min.z);
+        n->max.x = MAX(l->max.x, r->max.x);
+        n->max.y = MAX(l->max.y, r->max.y);
+        n->max.z = MAX(l->max.z, r->max.z);
+
+        node = n->parent;
+    }
+}
+
+/*
+ *    Inserts a leaf into the hierarchy, next to the node that it
+ *    makes grow the least.
+ *
+ *    @param scene_t *scene    The scene.
+ *    @param int      leaf     The leaf.
+ *
+ *    @return unsigned int     1 if successful, 0 if the leaf could not
+ *                             be given a parent, leaving it out.
+ */
+static unsigned int scene_insert_leaf(scene_t *scene, int leaf) {
+    int   node;
+    int   parent;
+    int   old_parent;
+    float area;
+    float cost;
+    float inherit;
+    float cost_left;
+    float cost_right;
+
+    if (scene->root == SCENE_NULL_NODE) {
+        scene->root               = leaf;
+        scene->nodes[leaf].parent = SCENE_NULL_NODE;
+        return 1;
+    }
+
+    node = scene->root;
+
+    while (scene->nodes[node].instance < 0) {
+        scene_node_t *n = &scene->nodes[node];
+        scene_node_t *l = &scene->nodes[n->left];
+        scene_node_t *r = &scene->nodes[n->right];
+
+        area    = scene_box_area(&n->min, &n->max);
+        cost    = 2.f * scene_union_area(n, &scene->nodes[leaf]);
+        inherit = cost - 2.f * area;
+
+        cost_left  = scene_union_area(l, &scene->nodes[leaf]) + inherit;
+        cost_right = scene_union_area(r, &scene->nodes[leaf]) + inherit;
+
+        if (l->instance < 0)
+            cost_left -= scene_box_area(&l->min, &l->max);
+        if (r->instance < 0)
+            cost_right -= scene_box_area(&r->min, &r->max);
+
+        /*
+         *    Pairing up with this node beats going further down.
+         */
+        if (cost < cost_left && cost < cost_right)
+            break;
+
+        node = cost_left < cost_right ? n->left : n->right;
+    }
+
+    /*
+     *    Put a new parent above the chosen sibling and the leaf.
+     */
+    parent = scene_node_alloc(scene);
+
+    if (parent == SCENE_NULL_NODE)
+        return 0;
+
+    old_parent = scene->nodes[node].parent;
+
+    scene->nodes[parent].parent = old_parent;
+    scene->nodes[parent].left   = node;
+    scene->nodes[parent].right  = leaf;
+    scene->nodes[node].parent   = parent;
+    scene->nodes[leaf].parent   = parent;
+
+    if (old_parent == SCENE_NULL_NODE) {
+        scene->root = parent;
+    } else if (scene->nodes[old_parent].left == node) {
+        scene->nodes[old_parent].left = parent;
+    } else {
+        scene->nodes[old_parent].right = parent;
+    }
+
+    scene_refit(scene, parent);
+
+    return 1;
+}
+
+/*
+ *    Takes a leaf out of the hierarchy, putting its sibling in the
+ *    place of their parent.
+ *
+ *    @param scene_t *scene    The scene.
+ *    @param int      leaf     The leaf.
+ */
+static void scene_remove_leaf(scene_t *scene, int leaf) {
+    int parent;
+    int grandparent;
+    int sibling;
+
+    if (leaf == scene->root) {
+        scene->root = SCENE_NULL_NODE;
+        return;
+    }
+
+    parent      = scene->nodes[leaf].parent;
+    grandparent = scene->nodes[parent].parent;
+    sibling     = scene->nodes[parent].left == leaf ? scene->nodes[parent].right : scene->nodes[parent].left;
+
+    scene->nodes[sibling].parent = grandparent;
+
+    if (grandparent == SCENE_NULL_NODE) {
+        scene->root = sibling;
+    } else {
+        if (scene->nodes[grandparent].left == parent) {
+            scene->nodes[grandparent].left = sibling;
+        } else {
+            scene->nodes[grandparent].right = sibling;
+        }
+
+        scene_refit(scene, grandparent);
+    }
+
+    scene_node_release(scene, parent);
+}
+
+/*
+ *    Creates an empty scene.
+ *
+ *    @return void *         The scene.
+ */
+void *scene_create(void) {
+    scene_t *scene = (scene_t *)malloc(sizeof(scene_t));
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Could not allocate scene.\n");
+        return (void *)0x0;
+    }
+
+    memset(scene, 0, sizeof(scene_t));
+
+    scene->node_free     = SCENE_NULL_NODE;
+    scene->root          = SCENE_NULL_NODE;
+    scene->instance_free = -1;
+
+    return (void *)scene;
+}
+
+/*
+ *    Frees a scene. The meshes in it are left alone.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_free(void *s) {
+    scene_t *scene = (scene_t *)s;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return;
+    }
+
+    free(scene->nodes);
+    free(scene->instances);
+    free(scene->stack);
+    free(scene);
+}
+
+/*
+ *    Adds a mesh instance to a scene.
+ *
+ *    @param void *s         The scene.
+ *    @param void *mesh      The mesh to draw for the instance.
+ *    @param vec3_t min      The minimum corner of the instance's world box.
+ *    @param vec3_t max      The maximum corner of the instance's world box.
+ *
+ *    @return u32            The instance handle, or SCENE_INVALID_HANDLE.
+ */
+u32 scene_add(void *s, void *mesh, vec3_t min, vec3_t max) {
+    scene_t          *scene = (scene_t *)s;
+    scene_instance_t *instances;
+    u32               handle;
+    u32               capacity;
+    int               leaf;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return SCENE_INVALID_HANDLE;
+    }
+    if (mesh == (void *)0x0) {
+        LOGF_ERR("Mesh is null.\n");
+        return SCENE_INVALID_HANDLE;
+    }
+
+    if (scene->instance_free < 0) {
+        if (scene->instance_count == scene->instance_capacity) {
+            capacity  = MAX(scene->instance_capacity * 2, 64);
+            instances = realloc(scene->instances, sizeof(scene_instance_t) * capacity);
+
+            if (instances == (scene_instance_t *)0x0) {
+                LOGF_ERR("Could not grow scene instances.\n");
+                return SCENE_INVALID_HANDLE;
+            }
+
+            scene->instances         = instances;
+            scene->instance_capacity = capacity;
+        }
+
+        handle = scene->instance_count++;
+    } else {
+        handle               = scene->instance_free;
+        scene->instance_free = scene->instances[handle].next_free;
+    }
+
+    leaf = scene_node_alloc(scene);
+
+    if (leaf == SCENE_NULL_NODE)
+        goto fail;
+
+    scene->nodes[leaf].min      = min;
+    scene->nodes[leaf].max      = max;
+    scene->nodes[leaf].instance = handle;
+
+    if (!scene_insert_leaf(scene, leaf)) {
+        scene_node_release(scene, leaf);
+        goto fail;
+    }
+
+    scene->instances[handle].mesh      = mesh;
+    scene->instances[handle].node      = leaf;
+    scene->instances[handle].next_free = -1;
+
+    return handle;
+
+fail:
+    scene->instances[handle].mesh      = nullptr;
+    scene->instances[handle].next_free = scene->instance_free;
+    scene->instance_free               = handle;
+
+    return SCENE_INVALID_HANDLE;
+}
+
+/*
+ *    Removes a mesh instance from a scene.
+ *
+ *    @param void *s         The scene.
+ *    @param u32 handle      The instance handle.
+ */
+void scene_remove(void *s, u32 handle) {
+    scene_t *scene = (scene_t *)s;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return;
+    }
+    if (handle >= scene->instance_count || scene->instances[handle].mesh == (void *)0x0) {
+        LOGF_ERR("Scene instance handle is invalid.\n");
+        return;
+    }
+
+    scene_remove_leaf(scene, scene->instances[handle].node);
+    scene_node_release(scene, scene->instances[handle].node);
+
+    scene->instances[handle].mesh      = nullptr;
+    scene->instances[handle].next_free = scene->instance_free;
+    scene->instance_free               = handle;
+}
+
+/*
+ *    Moves a mesh instance, refitting the boxes above it.
+ *
+ *    @param void *s         The scene.
+ *    @param u32 handle      The instance handle.
+ *    @param vec3_t min      The minimum corner of the instance's world box.
+ *    @param vec3_t max      The maximum corner of the instance's world box.
+ */
+void scene_set_bounds(void *s, u32 handle, vec3_t min, vec3_t max) {
+    scene_t *scene = (scene_t *)s;
+    int      leaf;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return;
+    }
+    if (handle >= scene->instance_count || scene->instances[handle].mesh == (void *)0x0) {
+        LOGF_ERR("Scene instance handle is invalid.\n");
+        return;
+    }
+
+    leaf = scene->instances[handle].node;
+
+    scene->nodes[leaf].min = min;
+    scene->nodes[leaf].max = max;
+
+    scene_refit(scene, scene->nodes[leaf].parent);
+}
+
+/*
+ *    Orders leaves by the center of their boxes along the sort axis.
+ */
+static int scene_compare_leaves(const void *a, const void *b) {
+    scene_node_t *na = &_scene_sort_nodes[*(const int *)a];
+    scene_node_t *nb = &_scene_sort_nodes[*(const int *)b];
+    float         ca = ((float *)&na->min)[_scene_sort_axis] + ((float *)&na->max)[_scene_sort_axis];
+    float         cb = ((float *)&nb->min)[_scene_sort_axis] + ((float *)&nb->max)[_scene_sort_axis];
+
+    return (ca > cb) - (ca < cb);
+}
+
+/*
+ *    Builds a subtree over a run of leaves, splitting them in half
+ *    along the axis their centers spread the most on. The free list
+ *    must hold a node for every leaf but one.
+ *
+ *    @param scene_t *scene     The scene.
+ *    @param int     *leaves    The leaves.
+ *    @param u32      count     The amount of leaves.
+ *
+ *    @return int               The root of the subtree.
+ */
+static int scene_build(scene_t *scene, int *leaves, u32 count) {
+    int    node;
+    int    left;
+    int    right;
+    vec3_t lo;
+    vec3_t hi;
+    float  c;
+
+    if (count == 1)
+        return leaves[0];
+
+    lo = (vec3_t){1e30f, 1e30f, 1e30f};
+    hi = (vec3_t){-1e30f, -1e30f, -1e30f};
+
+    for (u32 i = 0; i < count; i++) {
+        scene_node_t *n = &scene->nodes[leaves[i]];
+
+        c = n->min.x + n->max.x; lo.x = MIN(lo.x, c); hi.x = MAX(hi.x, c);
+        c = n->min.y + n->max.y; lo.y = MIN(lo.y, c); hi.y = MAX(hi.y, c);
+        c = n->min.z + n->max.z; lo.z = MIN(lo.z, c); hi.z = MAX(hi.z, c);
+    }
+
+    _scene_sort_axis = 0;
+
+    if (hi.y - lo.y > hi.x - lo.x)
+        _scene_sort_axis = 1;
+    if (hi.z - lo.z > ((float *)&hi)[_scene_sort_axis] - ((float *)&lo)[_scene_sort_axis])
+        _scene_sort_axis = 2;
+
+    _scene_sort_nodes = scene->nodes;
+    qsort(leaves, count, sizeof(int), scene_compare_leaves);
+
+    node  = scene_node_alloc(scene);
+    left  = scene_build(scene, leaves, count / 2);
+    right = scene_build(scene, leaves + count / 2, count - count / 2);
+
+    scene->nodes[node].left    = left;
+    scene->nodes[node].right   = right;
+    scene->nodes[left].parent  = node;
+    scene->nodes[right].parent = node;
+
+    scene_refit(scene, node);
+    scene->nodes[node].parent = SCENE_NULL_NODE;
+
+    return node;
+}
+
+/*
+ *    Rebuilds the hierarchy of a scene from scratch. Refitting keeps the
+ *    hierarchy correct, but after many instances have moved far, a
+ *    rebuild makes it tight again.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_rebuild(void *s) {
+    scene_t *scene = (scene_t *)s;
+    int     *leaves;
+    u32      count = 0;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return;
+    }
+
+    if (scene->root == SCENE_NULL_NODE)
+        return;
+
+    leaves = malloc(sizeof(int) * scene->instance_count);
+
+    if (leaves == (int *)0x0) {
+        LOGF_ERR("Could not allocate scene rebuild list.\n");
+        return;
+    }
+
+    /*
+     *    Keep the leaves, and let go of every node above them.
+     */
+    for (u32 i = 0; i < scene->instance_count; i++) {
+        if (scene->instances[i].mesh != (void *)0x0)
+            leaves[count++] = scene->instances[i].node;
+    }
+
+    /*
+     *    The nodes above the leaves are handed back before the build
+     *    takes them again, so only the shortfall, if any, is grown up
+     *    front, while the old hierarchy is still whole to fall back on.
+     */
+    if (scene->node_capacity - count < count - 1 &&
+        !scene_node_grow(scene, count + count - 1)) {
+        LOGF_ERR("Could not grow scene nodes for a rebuild, keeping the old hierarchy.\n");
+        free(leaves);
+        return;
+    }
+
+    for (u32 i = 0; i < scene->node_capacity; i++) {
+        if (scene->nodes[i].instance < 0 && scene->nodes[i].left != SCENE_NULL_NODE)
+            scene_node_release(scene, i);
+    }
+
+    scene->root = scene_build(scene, leaves, count);
+
+    free(leaves);
+}
+
+/*
+ *    Tests a box against the view frustum of a view projection matrix.
+ *
+ *    @param float  *m      The matrix, row major.
+ *    @param vec3_t *min    The minimum corner.
+ *    @param vec3_t *max    The maximum corner.
+ *
+ *    @return int           -1 if the box is outside of the view
+ *                          frustum, 1 if it is inside, 0 if it crosses it.
+ */
+static int scene_test_box(float *m, vec3_t *min, vec3_t *max) {
+    unsigned int all = CULL_FRUSTUM_MASK;
+    unsigned int any = 0;
+    unsigned int code;
+    vec3_t       p;
+    vec4_t       c;
+
+    for (u32 i = 0; i < 8; i++) {
+        p.x = (i & 1) ? max->x : min->x;
+        p.y = (i & 2) ? max->y : min->y;
+        p.z = (i & 4) ? max->z : min->z;
+
+        c.x = m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3];
+        c.y = m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7];
+        c.z = m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11];
+        c.w = m[12] * p.x + m[13] * p.y + m[14] * p.z + m[15];
+
+        code = cull_position_outcode(c) & CULL_FRUSTUM_MASK;
+        all &= code;
+        any |= code;
+    }
+
+    if (all)
+        return -1;
+
+    return any ? 0 : 1;
+}
+
+/*
+ *    Draws every mesh instance of a scene that is in view of the
+ *    current camera.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_draw(void *s) {
+    scene_t      *scene = (scene_t *)s;
+    mat4_t        view;
+    scene_node_t *n;
+    u32           top = 0;
+    int           node;
+    int           inside;
+    int           test;
+
+    if (scene == (scene_t *)0x0) {
+        LOGF_ERR("Scene is null.\n");
+        return;
+    }
+
+    if (scene->root == SCENE_NULL_NODE)
+        return;
+
+    /*
+     *    Without a camera there is nothing to cull against.
+     */
+    view = _camera ? camera_view(_camera) : m4_identity();
+
+    /*
+     *    Nodes found to be entirely in view are pushed flipped, so that
+     *    nothing below them gets tested again.
+     */
+    scene->stack[top++] = _camera ? scene->root : ~scene->root;
+
+    while (top > 0) {
+        node   = scene->stack[--top];
+        inside = node < 0;
+        node   = inside ? ~node : node;
+        n      = &scene->nodes[node];
+
+        if (!inside) {
+            test = scene_test_box((float *)&view, &n->min, &n->max);
+
+            if (test < 0)
+                continue;
+
+            inside = test > 0;
+        }
+
+        if (n->instance >= 0) {
+            mesh_draw(scene->instances[n->instance].mesh);
+            continue;
+        }
+
+        scene->stack[top++] = inside ? ~n->left : n->left;
+        scene->stack[top++] = inside ? ~n->right : n->right;
+    }
+}
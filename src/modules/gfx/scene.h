@@ -0,0 +1,110 @@
+/*
+ *    scene.h    --    header for the scene container
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    A scene is an optional container of mesh instances, each with a
+ *    box in world space. The boxes are kept in a bounding volume
+ *    hierarchy, so that drawing a scene only visits the parts of it
+ *    that the camera can see, instead of testing every mesh. Instances
+ *    can be added, moved and removed at any time, and the hierarchy is
+ *    refit around them as they change.
+ */
+#ifndef CHIK_GFX_SCENE_H
+#define CHIK_GFX_SCENE_H
+
+#include "libchik.h"
+
+#define SCENE_INVALID_HANDLE 0xffffffff
+#define SCENE_NULL_NODE      -1
+
+typedef struct {
+    vec3_t min;
+    vec3_t max;
+    int    parent;
+    int    left;
+    int    right;
+    int    instance;
+} scene_node_t;
+
+typedef struct {
+    void *mesh;
+    int   node;
+    int   next_free;
+} scene_instance_t;
+
+typedef struct {
+    scene_node_t     *nodes;
+    u32               node_count;
+    u32               node_capacity;
+    int               node_free;
+    int               root;
+    scene_instance_t *instances;
+    u32               instance_count;
+    u32               instance_capacity;
+    int               instance_free;
+    int              *stack;
+} scene_t;
+
+/*
+ *    Creates an empty scene.
+ *
+ *    @return void *         The scene.
+ */
+void *scene_create(void);
+
+/*
+ *    Frees a scene. The meshes in it are left alone.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_free(void *s);
+
+/*
+ *    Adds a mesh instance to a scene.
+ *
+ *    @param void *s         The scene.
+ *    @param void *mesh      The mesh to draw for the instance.
+ *    @param vec3_t min      The minimum corner of the instance's world box.
+ *    @param vec3_t max      The maximum corner of the instance's world box.
+ *
+ *    @return u32            The instance handle, or SCENE_INVALID_HANDLE.
+ */
+u32 scene_add(void *s, void *mesh, vec3_t min, vec3_t max);
+
+/*
+ *    Removes a mesh instance from a scene.
+ *
+ *    @param void *s         The scene.
+ *    @param u32 handle      The instance handle.
+ */
+void scene_remove(void *s, u32 handle);
+
+/*
+ *    Moves a mesh instance, refitting the boxes above it.
+ *
+ *    @param void *s         The scene.
+ *    @param u32 handle      The instance handle.
+ *    @param vec3_t min      The minimum corner of the instance's world box.
+ *    @param vec3_t max      The maximum corner of the instance's world box.
+ */
+void scene_set_bounds(void *s, u32 handle, vec3_t min, vec3_t max);
+
+/*
+ *    Rebuilds the hierarchy of a scene from scratch. Refitting keeps the
+ *    hierarchy correct, but after many instances have moved far, a
+ *    rebuild makes it tight again.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_rebuild(void *s);
+
+/*
+ *    Draws every mesh instance of a scene that is in view of the
+ *    current camera.
+ *
+ *    @param void *s         The scene.
+ */
+void scene_draw(void *s);
+
+#endif /* CHIK_GFX_SCENE_H  */
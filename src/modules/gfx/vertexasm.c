@@ -11,18 +11,186 @@
 
 #include <string.h>
 
-#include "cull.h"
+THREAD_LOCAL v_layout_t         _layout      = {.attributes = {0}, .count = 0};
+THREAD_LOCAL v_layout_t        *_layout_src  = nullptr;
+THREAD_LOCAL u32                _layout_gen  = 0;
+u32                             _layout_generation = 1;
+THREAD_LOCAL vertexasm_layout_t _layout_info = {.pos_offset = -1};
+void                           *_uniform     = nullptr;
 
+vertexasm_kernels_t             _kernels[VERTEX_ASM_MAX_KERNELS] = {0};
+unsigned int                    _kernel_count                    = 0;
 
-#ifdef _WIN32
-    #define THREAD_LOCAL __declspec( thread )
-#else
-    #define THREAD_LOCAL __thread
-#endif
+VERTEX_ASM_DEFINE_KERNELS(_kernels_6_pos0, 6, 0);
+VERTEX_ASM_DEFINE_KERNELS(_kernels_8_pos0, 8, 0);
+VERTEX_ASM_DEFINE_KERNELS(_kernels_9_pos0, 9, 0);
+VERTEX_ASM_DEFINE_KERNELS(_kernels_12_pos0, 12, 0);
 
+/*
+ *    The built in routines, for common sizes of layouts with the
+ *    position first, such as position and uv, position and color, and
+ *    position, uv and normal, packed or with every attribute in a vec4.
+ */
+vertexasm_kernels_t            *_builtin_kernels[] = {
+    &_kernels_6_pos0,
+    &_kernels_8_pos0,
+    &_kernels_9_pos0,
+    &_kernels_12_pos0,
+};
+
+/*
+ *    Works out the position offset and float counts of a layout.
+ *
+ *    @param v_layout_t         *layout    The layout.
+ *    @param vertexasm_layout_t *info      The facts to fill in.
+ */
+static void vertexasm_measure_layout(v_layout_t *layout, vertexasm_layout_t *info) {
+    size_t       i;
+    size_t       j;
+    unsigned int next;
+
+    info->pos_offset = -1;
+    info->floats     = layout->stride / sizeof(float);
+
+    for (i = 0; i < layout->count; i++) {
+        if (layout->attributes[i].usage == V_POS && info->pos_offset < 0)
+            info->pos_offset = layout->attributes[i].offset;
+
+        /*
+         *    An attribute runs up to the next attribute, or the end of
+         *    the vertex.
+         */
+        next = layout->stride;
+
+        for (j = 0; j < layout->count; j++) {
+            if (layout->attributes[j].offset > layout->attributes[i].offset && layout->attributes[j].offset < next)
+                next = layout->attributes[j].offset;
+        }
+
+        info->counts[i] = (next - layout->attributes[i].offset) / sizeof(float);
+    }
+}
+
+/*
+ *    Checks whether routines were registered for exactly the bound
+ *    layout's attributes.
+ *
+ *    @param vertexasm_kernels_t *kernels    The routines.
+ *
+ *    @return unsigned int                   1 if they match, 0 otherwise.
+ */
+static unsigned int vertexasm_kernels_match(vertexasm_kernels_t *kernels) {
+    size_t i;
+
+    if (kernels->floats != _layout_info.floats || kernels->pos_offset != _layout_info.pos_offset ||
+        kernels->count != _layout.count)
+        return 0;
+
+    for (i = 0; i < _layout.count; i++) {
+        if (kernels->usages[i] != _layout.attributes[i].usage || kernels->offsets[i] != _layout.attributes[i].offset ||
+            kernels->counts[i] != _layout_info.counts[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ *    Works out the position offset and float counts of the bound layout.
+ */
+static void vertexasm_compile_layout(void) {
+    size_t i;
+
+    vertexasm_measure_layout(&_layout, &_layout_info);
+
+    /*
+     *    Pick the specialized routines for this layout, if there are any.
+     */
+    _layout_info.kernels = nullptr;
+    _layout_info.v_add   = _layout.v_add;
+    _layout_info.v_scale = _layout.v_scale;
+
+    for (i = 0; i < _kernel_count; i++) {
+        if (vertexasm_kernels_match(&_kernels[i])) {
+            _layout_info.kernels = &_kernels[i];
+            _layout_info.v_add   = _kernels[i].add;
+            _layout_info.v_scale = _kernels[i].scale;
+            break;
+        }
+    }
+}
+
+/*
+ *    Registers specialized interpolation routines, which are used for
+ *    every layout bound afterwards with exactly the attributes they
+ *    name.
+ *
+ *    @param vertexasm_kernels_t *kernels    The routines.
+ *
+ *    @return unsigned int                   1 on success, 0 otherwise.
+ */
+unsigned int vertexasm_register_kernels(vertexasm_kernels_t *kernels) {
+    if (kernels == (vertexasm_kernels_t *)0x0) {
+        LOGF_ERR("Kernels are null.\n");
+        return 0;
+    }
+
+    if (kernels->count == 0 || kernels->count > MAX_VECTOR_ATTRIBUTES) {
+        LOGF_ERR("Kernels must name the attributes they are for.\n");
+        return 0;
+    }
+
+    if (_kernel_count >= VERTEX_ASM_MAX_KERNELS) {
+        LOGF_ERR("Too many vertex kernels registered.\n");
+        return 0;
+    }
+
+    _kernels[_kernel_count++] = *kernels;
+
+    vertexasm_invalidate_layouts();
+
+    return 1;
+}
+
+/*
+ *    Registers the built in routines of a layout's size for exactly
+ *    that layout's attributes. Only layouts whose v_add and v_scale add
+ *    and scale every float, leaving the position alone when scaling,
+ *    may be registered.
+ *
+ *    @param v_layout_t *layout    The layout.
+ *
+ *    @return unsigned int         1 if there were routines to register, 0 otherwise.
+ */
+unsigned int vertexasm_register_builtin_kernels(v_layout_t *layout) {
+    size_t              i;
+    size_t              j;
+    vertexasm_layout_t  info;
+    vertexasm_kernels_t kernels;
+
+    if (layout == (v_layout_t *)0x0 || layout->count == 0 || layout->count > MAX_VECTOR_ATTRIBUTES)
+        return 0;
 
-v_layout_t _layout  = {.attributes = {0}, .count = 0};
-void      *_uniform = nullptr;
+    vertexasm_measure_layout(layout, &info);
+
+    for (i = 0; i < ARR_LEN(_builtin_kernels); i++) {
+        if (_builtin_kernels[i]->floats != info.floats || _builtin_kernels[i]->pos_offset != info.pos_offset)
+            continue;
+
+        kernels       = *_builtin_kernels[i];
+        kernels.count = layout->count;
+
+        for (j = 0; j < layout->count; j++) {
+            kernels.usages[j]  = layout->attributes[j].usage;
+            kernels.offsets[j] = layout->attributes[j].offset;
+            kernels.counts[j]  = info.counts[j];
+        }
+
+        return vertexasm_register_kernels(&kernels);
+    }
+
+    return 0;
+}
 
 /*
  *    Sets the vertex assembler's vertex layout.
@@ -30,9 +198,39 @@ void      *_uniform = nullptr;
  *    @param v_layout_t layout   The layout of the vertex data.
  */
 void vertexasm_set_layout(v_layout_t layout) {
-    _layout = layout;
+    _layout     = layout;
+    _layout_src = nullptr;
+
+    vertexasm_compile_layout();
+}
+
+/*
+ *    Makes every thread bind its next layout again, even if it is at
+ *    the same address as the one it has bound. Layouts may have been
+ *    changed in place, freed and allocated again, or kernels may have
+ *    been registered. Must only be called while no worker is binding.
+ */
+void vertexasm_invalidate_layouts(void) {
+    if (++_layout_generation == 0)
+        _layout_generation = 1;
+}
+
+/*
+ *    Binds a vertex layout to the calling thread, skipping the copy
+ *    if the same layout is already bound, and nothing has been
+ *    invalidated since.
+ *
+ *    @param v_layout_t *layout   The layout of the vertex data.
+ */
+void vertexasm_bind_layout(v_layout_t *layout) {
+    if (layout == _layout_src && _layout_gen == _layout_generation)
+        return;
 
-    cull_set_vertex_size(_layout.stride);
+    _layout     = *layout;
+    _layout_src = layout;
+    _layout_gen = _layout_generation;
+
+    vertexasm_compile_layout();
 }
 
 /*
@@ -43,17 +241,10 @@ void vertexasm_set_layout(v_layout_t layout) {
  *    @return vec4_t       The position of the vertex.
  */
 vec4_t vertex_get_position(void *v) {
-    size_t i;
-
-    for (i = 0; i < _layout.count; i++) {
-        if (_layout.attributes[i].usage == V_POS)
-            break;
-    }
-
-    if (i == _layout.count)
+    if (_layout_info.pos_offset < 0)
         return (vec4_t){0, 0, 0, 0};
 
-    return *(vec4_t *)((unsigned char *)v + _layout.attributes[i].offset);
+    return *(vec4_t *)((unsigned char *)v + _layout_info.pos_offset);
 }
 
 /*
@@ -63,17 +254,10 @@ vec4_t vertex_get_position(void *v) {
  *    @param vec4_t pos       The position of the vertex.
  */
 void vertex_set_position(void *v, vec4_t pos) {
-    size_t i;
-
-    for (i = 0; i < _layout.count; i++) {
-        if (_layout.attributes[i].usage == V_POS)
-            break;
-    }
-
-    if (i == _layout.count)
+    if (_layout_info.pos_offset < 0)
         return;
 
-    *(vec4_t *)((unsigned char *)v + _layout.attributes[i].offset) = pos;
+    *(vec4_t *)((unsigned char *)v + _layout_info.pos_offset) = pos;
 }
 
 /*
@@ -81,13 +265,15 @@ void vertex_set_position(void *v, vec4_t pos) {
  *
  *    @param void *v          The raw vertex data.
  */
-void vertex_perspective_divide(char *v) {
-    vec4_t pos = vertex_get_position(v);
+void vertex_perspective_divide(void *v) {
+    vec4_t *pos;
 
-    pos.x /= pos.w;
-    pos.y /= pos.w;
+    if (_layout_info.pos_offset < 0)
+        return;
 
-    vertex_set_position(v, pos);
+    pos     = (vec4_t *)((unsigned char *)v + _layout_info.pos_offset);
+    pos->x /= pos->w;
+    pos->y /= pos->w;
 }
 
 /*
@@ -98,18 +284,19 @@ void vertex_perspective_divide(char *v) {
  *    @param void *v1          The raw vertex data of the second vertex.
  *    @param float dist        The "distance" between the two.
  */
-void vertex_build_differential(char *vd, char *v0, char *v1, float dist) {
-    size_t                 i;
-    static THREAD_LOCAL unsigned char buf[VERTEX_ASM_MAX_VERTEX_SIZE];
+void vertex_build_differential(void *vd, void *v0, void *v1, float dist) {
+    size_t i;
+    float *d = (float *)vd;
+    float *a = (float *)v0;
+    float *b = (float *)v1;
 
-    for (i = 0; i < _layout.count; i++) {
-        vec_sub((vec_t *)(vd + _layout.attributes[i].offset),
-                v1 + _layout.attributes[i].offset,
-                v0 + _layout.attributes[i].offset, _layout.attributes[i].fmt);
-            
-        vec_scale((vec_t *)(vd + _layout.attributes[i].offset),
-                  vd + _layout.attributes[i].offset, dist,
-                  _layout.attributes[i].fmt);
+    if (_layout_info.kernels != (vertexasm_kernels_t *)0x0) {
+        _layout_info.kernels->differential(vd, v0, v1, dist);
+        return;
+    }
+
+    for (i = 0; i < _layout_info.floats; i++) {
+        d[i] = (b[i] - a[i]) * dist;
     }
 }
 
@@ -120,8 +307,33 @@ void vertex_build_differential(char *vd, char *v0, char *v1, float dist) {
  *    @param void *v0          The raw vertex data of the first vertex.
  *    @param void *v1          The raw vertex data of the second vertex.
  */
-void vertex_add(char *vd, char *v0, char *v1) {
-    _layout.v_add(vd, v0, v1);
+void vertex_add(void *vd, void *v0, void *v1) {
+    _layout_info.v_add(vd, v0, v1);
+}
+
+/*
+ *    Interpolates between two vertices into caller provided memory.
+ *
+ *    @param void *vd          The destination raw vertex data.
+ *    @param void *v0          The raw vertex data of the first vertex.
+ *    @param void *v1          The raw vertex data of the second vertex.
+ *    @param float   diff        The normalized difference between the two
+ * vertices.
+ */
+void vertex_interpolate(void *vd, void *v0, void *v1, float diff) {
+    size_t i;
+    float *d = (float *)vd;
+    float *a = (float *)v0;
+    float *b = (float *)v1;
+
+    if (_layout_info.kernels != (vertexasm_kernels_t *)0x0) {
+        _layout_info.kernels->interp(vd, v0, v1, diff);
+        return;
+    }
+
+    for (i = 0; i < _layout_info.floats; i++) {
+        d[i] = a[i] + (b[i] - a[i]) * diff;
+    }
 }
 
 /*
@@ -134,16 +346,10 @@ void vertex_add(char *vd, char *v0, char *v1) {
  *
  *    @return void *       The raw vertex data of the new vertex.
  */
-void *vertex_build_interpolated(char *v0, char *v1, float diff) {
-    size_t                 i;
-    static THREAD_LOCAL unsigned char buf[VERTEX_ASM_MAX_VERTEX_SIZE];
+void *vertex_build_interpolated(void *v0, void *v1, float diff) {
+    static THREAD_LOCAL float buf[VERTEX_ASM_MAX_VERTEX_SIZE / sizeof(float)];
 
-    for (i = 0; i < _layout.count; i++) {
-        vec_interp((vec_t *)(buf + _layout.attributes[i].offset),
-                   v0 + _layout.attributes[i].offset,
-                   v1 + _layout.attributes[i].offset, diff,
-                   _layout.attributes[i].fmt);
-    }
+    vertex_interpolate(buf, v0, v1, diff);
 
     return buf;
 }
@@ -157,7 +363,7 @@ void *vertex_build_interpolated(char *v0, char *v1, float diff) {
  *    @param unsigned int   flags   A usage flag that determines how to scale the vertex.
  */
 void vertex_scale(void *vd, void *v, float scale, unsigned int flags) {
-    _layout.v_scale(vd, v, scale);
+    _layout_info.v_scale(vd, v, scale);
 }
 
 /*
@@ -17,13 +17,135 @@
 
 #define VERTEX_ASM_MAX_VERTEX_SIZE (1024)
 
+#ifdef _WIN32
+    #define THREAD_LOCAL __declspec( thread )
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
+#define VERTEX_ASM_MAX_KERNELS (16)
+
+/*
+ *    Interpolation routines specialized for a vertex of a fixed size,
+ *    with the position at a fixed offset. These are generated with
+ *    VERTEX_ASM_DEFINE_KERNELS, and are registered for an exact list
+ *    of attributes, by usage, offset and float count. Once registered,
+ *    they replace the layout's own v_add and v_scale for every layout
+ *    with exactly those attributes.
+ */
+typedef struct {
+    unsigned int floats;
+    int          pos_offset;
+    void (*interp)(void *vd, void *v0, void *v1, float t);
+    void (*differential)(void *vd, void *v0, void *v1, float dist);
+    void (*add)(void *vd, void *v0, void *v1);
+    void (*scale)(void *vd, void *v, float s);
+    unsigned int count;
+    unsigned int usages[MAX_VECTOR_ATTRIBUTES];
+    unsigned int offsets[MAX_VECTOR_ATTRIBUTES];
+    unsigned int counts[MAX_VECTOR_ATTRIBUTES];
+} vertexasm_kernels_t;
+
+/*
+ *    Generates a vertexasm_kernels_t called name, for vertices of
+ *    FLOATS floats with the position starting at float POS. The loop
+ *    counts are constants, so the compiler unrolls and vectorizes them.
+ *    Like the rasterizer expects of v_scale, scaling leaves the position
+ *    alone, since it carries the interpolated depth.
+ */
+#define VERTEX_ASM_DEFINE_KERNELS(name, FLOATS, POS)                               \
+    static void name##_interp(void *vd, void *v0, void *v1, float t) {            \
+        size_t i;                                                                  \
+        float *d = (float *)vd, *a = (float *)v0, *b = (float *)v1;               \
+        for (i = 0; i < (FLOATS); i++)                                             \
+            d[i] = a[i] + (b[i] - a[i]) * t;                                       \
+    }                                                                              \
+    static void name##_differential(void *vd, void *v0, void *v1, float dist) {   \
+        size_t i;                                                                  \
+        float *d = (float *)vd, *a = (float *)v0, *b = (float *)v1;               \
+        for (i = 0; i < (FLOATS); i++)                                             \
+            d[i] = (b[i] - a[i]) * dist;                                           \
+    }                                                                              \
+    static void name##_add(void *vd, void *v0, void *v1) {                         \
+        size_t i;                                                                  \
+        float *d = (float *)vd, *a = (float *)v0, *b = (float *)v1;               \
+        for (i = 0; i < (FLOATS); i++)                                             \
+            d[i] = a[i] + b[i];                                                    \
+    }                                                                              \
+    static void name##_scale(void *vd, void *v, float s) {                         \
+        size_t i;                                                                  \
+        float *d = (float *)vd, *a = (float *)v;                                  \
+        for (i = 0; i < (FLOATS); i++)                                             \
+            d[i] = (i >= (POS) && i < (POS) + 4) ? a[i] : a[i] * s;               \
+    }                                                                              \
+    vertexasm_kernels_t name = {(FLOATS), (POS) * sizeof(float), name##_interp,   \
+                                name##_differential, name##_add, name##_scale}
+
+/*
+ *    Facts about the bound layout that the hot paths need, worked out
+ *    once when the layout is bound instead of on every vertex access.
+ *    Attributes are assumed to be tightly made up of floats.
+ */
+typedef struct {
+    int                  pos_offset;
+    unsigned int         counts[MAX_VECTOR_ATTRIBUTES];
+    unsigned int         floats;
+    vertexasm_kernels_t *kernels;
+    void (*v_add)(void *, void *, void *);
+    void (*v_scale)(void *, void *, float);
+} vertexasm_layout_t;
+
+extern THREAD_LOCAL vertexasm_layout_t _layout_info;
+
 /*
  *    Sets the vertex assembler's vertex layout.
  *
+ *    The layout is tracked per thread, so that worker threads
+ *    can rasterize triangles of differing layouts at once.
+ *
  *    @param v_layout_t layout   The layout of the vertex data.
  */
 void vertexasm_set_layout(v_layout_t layout);
 
+/*
+ *    Binds a vertex layout to the calling thread, skipping the copy
+ *    if the same layout is already bound, and nothing has been
+ *    invalidated since.
+ *
+ *    @param v_layout_t *layout   The layout of the vertex data.
+ */
+void vertexasm_bind_layout(v_layout_t *layout);
+
+/*
+ *    Makes every thread bind its next layout again, even if it is at
+ *    the same address as the one it has bound. Must only be called
+ *    while no worker is binding.
+ */
+void vertexasm_invalidate_layouts(void);
+
+/*
+ *    Registers specialized interpolation routines, which are used for
+ *    every layout bound afterwards with exactly the attributes they
+ *    name.
+ *
+ *    @param vertexasm_kernels_t *kernels    The routines.
+ *
+ *    @return unsigned int                   1 on success, 0 otherwise.
+ */
+unsigned int vertexasm_register_kernels(vertexasm_kernels_t *kernels);
+
+/*
+ *    Registers the built in routines of a layout's size for exactly
+ *    that layout's attributes. Only layouts whose v_add and v_scale add
+ *    and scale every float, leaving the position alone when scaling,
+ *    may be registered.
+ *
+ *    @param v_layout_t *layout    The layout.
+ *
+ *    @return unsigned int         1 if there were routines to register, 0 otherwise.
+ */
+unsigned int vertexasm_register_builtin_kernels(v_layout_t *layout);
+
 /*
  *    Extracts the position from a vertex.
  *
@@ -67,6 +189,17 @@ void vertex_build_differential(void *vd, void *v0, void *v1, float dist);
  */
 void vertex_add(void *vd, void *v0, void *v1);
 
+/*
+ *    Interpolates between two vertices into caller provided memory.
+ *
+ *    @param void *vd          The destination raw vertex data.
+ *    @param void *v0          The raw vertex data of the first vertex.
+ *    @param void *v1          The raw vertex data of the second vertex.
+ *    @param float   diff        The normalized difference between the two
+ * vertices.
+ */
+void vertex_interpolate(void *vd, void *v0, void *v1, float diff);
+
 /*
  *    Builds a new vertex given two vertices and a normalized difference.
  *
@@ -0,0 +1,266 @@
+/*
+ *    visbuf.c    --    source for the visibility buffer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    The buffer holds the index of the visible triangle of each pixel,
+ *    into the list of binned triangles. The barycentrics of a pixel are
+ *    worked out again from its triangle's edges when it is shaded, and
+ *    its depth is read back from the depth buffer.
+ */
+#include "visbuf.h"
+
+#include <string.h>
+
+#include "depth.h"
+#include "vertexasm.h"
+
+extern rendertarget_t *_raster_target;
+extern depthbuffer_t  *_z_buffer;
+
+extern THREAD_LOCAL v_layout_t _layout;
+
+u32 *_visbuf        = nullptr;
+u32  _visbuf_width  = 0;
+u32  _visbuf_height = 0;
+
+/*
+ *    A triangle set up for shading, kept while neighbouring pixels
+ *    belong to the same triangle.
+ */
+typedef struct {
+    u32             id;
+    bin_triangle_t *tri;
+    float           a[3];
+    float           b[3];
+    float           c[3];
+    float           inv_area;
+    unsigned char   pIA[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char   pIB[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char   pIC[VERTEX_ASM_MAX_VERTEX_SIZE];
+} visbuf_setup_t;
+
+typedef struct {
+    bin_triangle_t *tris;
+    u32             y0;
+    u32             y1;
+} visbuf_band_t;
+
+/*
+ *    Sets up the visibility buffer, with every pixel empty.
+ *
+ *    @param unsigned int width     The width of the render target.
+ *    @param unsigned int height    The height of the render target.
+ *
+ *    @return unsigned int          1 on success, 0 on failure.
+ */
+unsigned int visbuf_init(unsigned int width, unsigned int height) {
+    visbuf_free();
+
+    _visbuf = malloc(sizeof(u32) * width * height);
+
+    if (_visbuf == (u32 *)0x0) {
+        LOGF_ERR("Could not allocate visibility buffer.\n");
+        return 0;
+    }
+
+    memset(_visbuf, 0xff, sizeof(u32) * width * height);
+
+    _visbuf_width  = width;
+    _visbuf_height = height;
+
+    return 1;
+}
+
+/*
+ *    Sets a triangle up for shading, the same way the halfspace
+ *    rasterizer does, with attributes scaled by their inverse depth.
+ *
+ *    @param visbuf_setup_t *s       The setup to fill in.
+ *    @param bin_triangle_t *tris    The binned triangles.
+ *    @param u32             id      The index of the triangle.
+ */
+static void visbuf_setup_triangle(visbuf_setup_t *s, bin_triangle_t *tris, u32 id) {
+    u32     stride;
+    char   *r0;
+    char   *r1;
+    char   *r2;
+    char   *tempv;
+    float   area;
+    float   x[3];
+    float   y[3];
+    vec4_t  p[3];
+
+    s->id  = id;
+    s->tri = &tris[id];
+
+    vertexasm_bind_layout(s->tri->layout);
+
+    stride = s->tri->layout->stride;
+    r0     = s->tri->verts;
+    r1     = r0 + stride;
+    r2     = r0 + 2 * stride;
+
+    for (int i = 0; i < 3; i++) {
+        p[i] = vertex_get_position(r0 + i * stride);
+        x[i] = (p[i].x + 1.0f) * _visbuf_width / 2;
+        y[i] = (p[i].y + 1.0f) * _visbuf_height / 2;
+    }
+
+    area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+
+    if (area < 0.f) {
+        tempv = r1;
+        r1    = r2;
+        r2    = tempv;
+        p[1]  = vertex_get_position(r1);
+        p[2]  = vertex_get_position(r2);
+        x[1]  = (p[1].x + 1.0f) * _visbuf_width / 2;
+        y[1]  = (p[1].y + 1.0f) * _visbuf_height / 2;
+        x[2]  = (p[2].x + 1.0f) * _visbuf_width / 2;
+        y[2]  = (p[2].y + 1.0f) * _visbuf_height / 2;
+        area  = -area;
+    }
+
+    /*
+     *    Edge i is opposite of vertex i, so the value of edge i divided
+     *    by the area is the barycentric weight of vertex i.
+     */
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        int k = (i + 2) % 3;
+
+        s->a[i] = y[j] - y[k];
+        s->b[i] = x[k] - x[j];
+        s->c[i] = x[j] * y[k] - x[k] * y[j];
+    }
+
+    s->inv_area = area > 0.f ? 1.0f / area : 0.f;
+
+    vertex_scale(s->pIA, r0, 1 / p[0].z, V_POS);
+    vertex_scale(s->pIB, r1, 1 / p[1].z, V_POS);
+    vertex_scale(s->pIC, r2, 1 / p[2].z, V_POS);
+
+    p[0].z = 1 / p[0].z;
+    p[1].z = 1 / p[1].z;
+    p[2].z = 1 / p[2].z;
+
+    vertex_set_position(s->pIA, p[0]);
+    vertex_set_position(s->pIB, p[1]);
+    vertex_set_position(s->pIC, p[2]);
+}
+
+/*
+ *    Shades a band of rows of the visibility buffer, emptying it as it
+ *    goes.
+ *
+ *    @param void *params    The visbuf_band_t to shade.
+ *
+ *    @return void *         NULL.
+ */
+static void *visbuf_resolve_band(void *params) {
+    visbuf_band_t *band  = (visbuf_band_t *)params;
+    visbuf_setup_t s     = {.id = VISBUF_EMPTY};
+    float          b1;
+    float          b2;
+    float          cx;
+    float          cy;
+    u32            x;
+    u32            y;
+    u32            id;
+    u32           *ids;
+    u32            depth;
+    unsigned char *raster;
+    fragment_t     f;
+    unsigned char  v[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char  tmp[VERTEX_ASM_MAX_VERTEX_SIZE];
+    unsigned char  scaled_v[VERTEX_ASM_MAX_VERTEX_SIZE];
+
+    for (y = band->y0; y < band->y1; y++) {
+        ids    = _visbuf + y * _visbuf_width;
+        depth  = y * _visbuf_width;
+        raster = (unsigned char *)_raster_target->target->buf + y * _visbuf_width * 3;
+        cy     = y + 0.5f;
+
+        for (x = 0; x < _visbuf_width; x++) {
+            id = ids[x];
+
+            if (id == VISBUF_EMPTY)
+                continue;
+
+            ids[x] = VISBUF_EMPTY;
+
+            if (id != s.id)
+                visbuf_setup_triangle(&s, band->tris, id);
+
+            cx = x + 0.5f;
+            b1 = (s.a[1] * cx + s.b[1] * cy + s.c[1]) * s.inv_area;
+            b2 = (s.a[2] * cx + s.b[2] * cy + s.c[2]) * s.inv_area;
+
+            /*
+             *    V = A + (B - A) * b1 + (C - A) * b2, and then the
+             *    attributes are brought back out of their inverse
+             *    depth scaling with the pixel's depth.
+             */
+            vertex_interpolate(v, s.pIA, s.pIB, b1);
+            vertex_build_differential(tmp, s.pIA, s.pIC, b2);
+            _layout_info.v_add(v, v, tmp);
+            _layout_info.v_scale(scaled_v, v, depth_decode(_z_buffer, depth_load(_z_buffer, depth + x)));
+
+            f.pos.x = x;
+            f.pos.y = y;
+
+            _layout.f_fun(&f, scaled_v, s.tri->assets, s.tri->material);
+
+            memcpy(raster + x * 3, &f.color, 3);
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ *    Shades every pixel with a visible triangle, and empties the
+ *    visibility buffer.
+ *
+ *    @param bin_triangle_t *tris        The triangles the buffer refers to.
+ *    @param unsigned int    threaded    Whether to shade across the threadpool.
+ */
+void visbuf_resolve(bin_triangle_t *tris, unsigned int threaded) {
+    visbuf_band_t bands[VISBUF_BANDS];
+    u32           rows = (_visbuf_height + VISBUF_BANDS - 1) / VISBUF_BANDS;
+    u32           count = 0;
+
+    if (_visbuf == (u32 *)0x0)
+        return;
+
+    for (u32 y = 0; y < _visbuf_height; y += rows) {
+        bands[count].tris = tris;
+        bands[count].y0   = y;
+        bands[count].y1   = MIN(y + rows, _visbuf_height);
+
+        if (threaded)
+            threadpool_submit(visbuf_resolve_band, &bands[count]);
+        else
+            visbuf_resolve_band(&bands[count]);
+
+        count++;
+    }
+
+    /*
+     *    The bands live on this stack frame.
+     */
+    if (threaded)
+        threadpool_wait();
+}
+
+/*
+ *    Frees the visibility buffer.
+ */
+void visbuf_free(void) {
+    free(_visbuf);
+
+    _visbuf        = nullptr;
+    _visbuf_width  = 0;
+    _visbuf_height = 0;
+}
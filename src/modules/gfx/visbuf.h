@@ -0,0 +1,50 @@
+/*
+ *    visbuf.h    --    header for the visibility buffer
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    With a visibility buffer, the rasterizer only resolves depth, and
+ *    records which triangle is visible in each pixel. Once every
+ *    triangle of a render group has been rasterized, the screen is
+ *    shaded in evenly sized bands across the threadpool, working each
+ *    pixel's attributes out from its triangle, so that the fragment
+ *    function runs once per visible pixel, and no attributes are
+ *    interpolated for hidden ones.
+ */
+#ifndef CHIK_GFX_VISBUF_H
+#define CHIK_GFX_VISBUF_H
+
+#include "libchik.h"
+
+#include "bin.h"
+
+#define VISBUF_EMPTY 0xffffffff
+#define VISBUF_BANDS 64
+
+extern u32 *_visbuf;
+
+/*
+ *    Sets up the visibility buffer, with every pixel empty.
+ *
+ *    @param unsigned int width     The width of the render target.
+ *    @param unsigned int height    The height of the render target.
+ *
+ *    @return unsigned int          1 on success, 0 on failure.
+ */
+unsigned int visbuf_init(unsigned int width, unsigned int height);
+
+/*
+ *    Shades every pixel with a visible triangle, and empties the
+ *    visibility buffer.
+ *
+ *    @param bin_triangle_t *tris        The triangles the buffer refers to.
+ *    @param unsigned int    threaded    Whether to shade across the threadpool.
+ */
+void visbuf_resolve(bin_triangle_t *tris, unsigned int threaded);
+
+/*
+ *    Frees the visibility buffer.
+ */
+void visbuf_free(void);
+
+#endif /* CHIK_GFX_VISBUF_H  */
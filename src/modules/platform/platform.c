@@ -40,6 +40,8 @@
 
 #define MAX_STDIN_READ 256
 
+#define PRESENT_LEND_MAX 2
+
 unsigned int _keys[MAX_INPUT_TYPES]                        = {0};
 char         _key_alias[MAX_INPUT_TYPES][MAX_ALIAS_LENGTH] = {{'\0'}};
 
@@ -54,6 +56,13 @@ SDL_Texture  *_tex  = nullptr;
 
 const char *_key_state                   = nullptr;
 char        _key_mask[SDL_NUM_SCANCODES] = {0};
+
+/*
+ *    Frames are lent out as locked streaming textures of their own,
+ *    separate from the texture copied frames are uploaded to.
+ */
+SDL_Texture *_lend_tex[PRESENT_LEND_MAX]    = {nullptr};
+void        *_lend_pixels[PRESENT_LEND_MAX] = {nullptr};
 #endif /* USE_SDL  */
 
 vec2u_t platform_get_screen_size(void);
@@ -163,6 +172,61 @@ void audio_quit(void) {
 #endif /* USE_ALSA  */
 }
 
+#if USE_SDL
+/*
+ *    Lends a locked streaming texture to draw a frame into.
+ *
+ *    @param image_t *image    The image to point at the lent memory.
+ *
+ *    @return unsigned int     1 if the image was lent memory, 0 otherwise.
+ */
+static unsigned int present_lend_image(image_t *image) {
+    void        *pixels;
+    int          pitch;
+    size_t       i;
+    unsigned int row = image->width * _pixel_sizes[image->fmt];
+
+    if (image->fmt != IMAGE_FMT_RGB8)
+        return 0;
+
+    for (i = 0; i < PRESENT_LEND_MAX; ++i) {
+        if (_lend_pixels[i] != nullptr && _lend_pixels[i] == (void *)image->buf)
+            return 1;
+    }
+
+    for (i = 0; i < PRESENT_LEND_MAX && _lend_pixels[i] != nullptr; ++i)
+        ;
+
+    if (i == PRESENT_LEND_MAX)
+        return 0;
+
+    if (_lend_tex[i] == nullptr) {
+        _lend_tex[i] = SDL_CreateTexture(_rend, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING,
+                                         image->width, image->height);
+
+        if (_lend_tex[i] == nullptr)
+            return 0;
+    }
+
+    if (SDL_LockTexture(_lend_tex[i], nullptr, &pixels, &pitch) < 0)
+        return 0;
+
+    /*
+     *    The image's rows are tightly packed, so the texture's have to
+     *    be as well.
+     */
+    if ((unsigned int)pitch != row) {
+        SDL_UnlockTexture(_lend_tex[i]);
+        return 0;
+    }
+
+    _lend_pixels[i] = pixels;
+    image->buf      = pixels;
+
+    return 1;
+}
+#endif /* USE_SDL  */
+
 /*
  *    Initializes SDL for presentation and input.
  */
@@ -244,6 +308,15 @@ SDL_Window *surface_get_window(void) {
  */
 void surface_quit(void) {
 #if USE_SDL
+    size_t i;
+
+    for (i = 0; i < PRESENT_LEND_MAX; ++i) {
+        SDL_DestroyTexture(_lend_tex[i]);
+
+        _lend_tex[i]    = nullptr;
+        _lend_pixels[i] = nullptr;
+    }
+
     SDL_DestroyTexture(_tex);
     SDL_DestroyRenderer(_rend);
     SDL_DestroyWindow(_win);
@@ -411,6 +484,22 @@ unsigned int input_parse(const char *file) {
  */
 unsigned int platform_draw_image(image_t *image) {
 #if USE_SDL
+    size_t i;
+
+    for (i = 0; i < PRESENT_LEND_MAX; ++i) {
+        if (_lend_pixels[i] != nullptr && _lend_pixels[i] == (void *)image->buf) {
+            SDL_UnlockTexture(_lend_tex[i]);
+            _lend_pixels[i] = nullptr;
+
+            SDL_RenderClear(_rend);
+            SDL_RenderCopyEx(_rend, _lend_tex[i], nullptr, nullptr, 0.0, nullptr,
+                             SDL_FLIP_VERTICAL);
+            SDL_RenderPresent(_rend);
+
+            return 1;
+        }
+    }
+
     SDL_RenderClear(_rend);
     SDL_UpdateTexture(_tex, nullptr, image->buf, image->width * _pixel_sizes[image->fmt]);
     SDL_RenderCopyEx(_rend, _tex, nullptr, nullptr, 0.0, nullptr,
@@ -420,6 +509,28 @@ unsigned int platform_draw_image(image_t *image) {
     return 1;
 }
 
+/*
+ *    Lends memory to draw the next frame into, so that presenting it
+ *    with platform_draw_image needs no copy. On success, the image's
+ *    buffer is pointed at the lent memory, which stays valid until the
+ *    image is presented, and whose contents are undefined until drawn.
+ *    Lending an image that is already lent memory keeps it.
+ *
+ *    @param image_t *image    The image to draw into.
+ *
+ *    @return unsigned int     1 if the image was lent memory, 0 if it
+ *                             should keep its own.
+ */
+unsigned int platform_acquire_image(image_t *image) {
+#if USE_SDL
+    if (_rend == nullptr)
+        return 0;
+
+    return present_lend_image(image);
+#endif /* USE_SDL  */
+    return 0;
+}
+
 /*
  *    Returns the width and height of the screen.
  *
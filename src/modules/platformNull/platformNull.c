@@ -0,0 +1,430 @@
+/*
+ *    platformNull.c    --    source for the headless platform
+ *
+ *    This file is part of the Chik engine.
+ *
+ *    This file defines the same platform functions as the SDL platform,
+ *    without a display, window, or audio device, for running on servers
+ *    and benchmarking.
+ *
+ *    The screen is only as big as -w and -h say it is. Frames handed
+ *    to platform_draw_image are discarded, or, with --dump-frames DIR,
+ *    written to DIR as numbered PPM files, or as the image's raw bytes
+ *    with --dump-raw. Input comes from a script given with
+ *    --input-script FILE, with one event per line, either
+ *
+ *        <frame> <alias>
+ *        <frame> mouse <dx> <dy>
+ *
+ *    where frames count from 1, and lines starting with # are
+ *    skipped. Events of the same frame happen in the order they are
+ *    written in. Sound is thrown away, and with --frame-limit N, the
+ *    platform asks the engine to stop after N frames.
+ */
+#include "libchik.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* __unix__  */
+
+#define PCM_CHANNELS     2
+#define PCM_SAMPLE_RATE  48000
+#define PCM_BUFFER_SIZE  8192
+#define PCM_SAMPLE_WIDTH 16
+
+#define DEFAULT_WIDTH  1920
+#define DEFAULT_HEIGHT 1080
+
+#define MAX_ALIAS_LENGTH 32
+#define MAX_DUMP_PATH    1024
+
+#define MAX_STDIN_READ 256
+
+typedef struct {
+    unsigned int frame;
+    unsigned int line;
+    unsigned int mouse;
+    int          dx;
+    int          dy;
+    char         alias[MAX_ALIAS_LENGTH];
+} script_event_t;
+
+vec2u_t         _screen_size       = {DEFAULT_WIDTH, DEFAULT_HEIGHT};
+
+unsigned int    _frame             = 0;
+int             _frame_limit       = -1;
+
+const char     *_dump_dir          = nullptr;
+unsigned int    _dump_raw          = 0;
+unsigned int    _dump_count        = 0;
+
+script_event_t *_script            = nullptr;
+unsigned int    _script_count      = 0;
+unsigned int    _script_next       = 0;
+vec2u_t         _mouse_delta       = {0, 0};
+
+/*
+ *    Orders events by frame, and then by line, so that events of the
+ *    same frame keep the order they are written in.
+ */
+static int input_compare_events(const void *a, const void *b) {
+    const script_event_t *ea = (const script_event_t *)a;
+    const script_event_t *eb = (const script_event_t *)b;
+
+    if (ea->frame != eb->frame)
+        return (ea->frame > eb->frame) - (ea->frame < eb->frame);
+
+    return (ea->line > eb->line) - (ea->line < eb->line);
+}
+
+/*
+ *    Parses the input script, and sorts its events by frame.
+ *
+ *    @param const char *file    The file with the script.
+ *
+ *    @return unsigned int       1 if successful, 0 otherwise.
+ */
+unsigned int input_parse_script(const char *file) {
+    unsigned int    fileLen;
+    char           *pFile = file_read(file, &fileLen);
+    char           *text;
+    char           *line;
+    char           *end;
+    unsigned int    number = 0;
+    char            word[MAX_ALIAS_LENGTH];
+    script_event_t  e;
+    script_event_t *script;
+
+    if (pFile == nullptr) {
+        VLOGF_ERR("Failed to read input script: %s\n", file);
+        return 0;
+    }
+
+    /*
+     *    Lines are parsed as strings, so the file needs an end.
+     */
+    text = malloc(fileLen + 1);
+
+    if (text == nullptr) {
+        LOGF_ERR("Could not allocate input script.\n");
+        file_free(pFile);
+        return 0;
+    }
+
+    memcpy(text, pFile, fileLen);
+    text[fileLen] = '\0';
+
+    file_free(pFile);
+
+    for (line = text; *line != '\0'; line = end) {
+        end = strchr(line, '\n');
+
+        if (end != nullptr)
+            *end++ = '\0';
+        else
+            end = line + strlen(line);
+
+        number++;
+
+        while (*line != '\0' && *line <= ' ')
+            line++;
+
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        memset(&e, 0, sizeof(e));
+
+        e.line = number;
+
+        if (sscanf(line, "%u %31s", &e.frame, word) != 2) {
+            VLOGF_ERR("Invalid input script line: %s\n", line);
+            continue;
+        }
+
+        if (strcmp(word, "mouse") == 0) {
+            if (sscanf(line, "%*u %*s %d %d", &e.dx, &e.dy) != 2) {
+                VLOGF_ERR("Invalid mouse event: %s\n", line);
+                continue;
+            }
+
+            e.mouse = 1;
+        } else {
+            strcpy(e.alias, word);
+        }
+
+        script = realloc(_script, sizeof(script_event_t) * (_script_count + 1));
+
+        if (script == nullptr) {
+            LOGF_ERR("Could not grow input script.\n");
+            break;
+        }
+
+        _script                  = script;
+        _script[_script_count++] = e;
+    }
+
+    free(text);
+
+    /*
+     *    Events are popped in the order they are stored, a frame at a
+     *    time.
+     */
+    if (_script_count > 1)
+        qsort(_script, _script_count, sizeof(script_event_t), input_compare_events);
+
+    return 1;
+}
+
+/*
+ *    Writes a frame to the dump directory. PPM files are written top
+ *    row first, where images are stored bottom row first, and raw
+ *    files are the image's bytes as they are.
+ *
+ *    @param image_t *image    The image to write.
+ */
+void surface_dump_image(image_t *image) {
+    FILE        *f;
+    unsigned int y;
+    size_t       row = (size_t)image->width * _pixel_sizes[image->fmt];
+    char         path[MAX_DUMP_PATH];
+
+    if (!_dump_raw && image->fmt != IMAGE_FMT_RGB8) {
+        LOGF_ERR("Only RGB8 images can be dumped as PPM, use --dump-raw.\n");
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/frame%06u.%s", _dump_dir, _dump_count++, _dump_raw ? "raw" : "ppm");
+
+    f = fopen(path, "wb");
+
+    if (f == nullptr) {
+        VLOGF_ERR("Could not open frame dump: %s\n", path);
+        return;
+    }
+
+    if (_dump_raw) {
+        fwrite(image->buf, row, image->height, f);
+    } else {
+        fprintf(f, "P6\n%u %u\n255\n", image->width, image->height);
+
+        for (y = image->height; y > 0; --y) {
+            fwrite((char *)image->buf + (y - 1) * row, row, 1, f);
+        }
+    }
+
+    fclose(f);
+}
+
+/*
+ *    Returns the SDL window, of which there is none.
+ */
+void *surface_get_window(void) {
+    return nullptr;
+}
+
+/*
+ *    Sets the size of the screen.
+ *
+ *    @param vec2u_t size    The size to set.
+ */
+void surface_set_size(vec2u_t size) {
+    _screen_size = size;
+}
+
+/*
+ *    Draws a bitmap to the screen, which only means dumping it if
+ *    frames are being dumped.
+ *
+ *    @param image_t *image    The image to draw.
+ *
+ *    @return unsigned int         1 if successful, 0 otherwise.
+ */
+unsigned int platform_draw_image(image_t *image) {
+    if (_dump_dir != nullptr)
+        surface_dump_image(image);
+
+    return 1;
+}
+
+/*
+ *    Lends memory to draw the next frame into. Frames are dumped
+ *    straight from the caller's image, so there is nothing to lend.
+ *
+ *    @param image_t *image    The image to draw into.
+ *
+ *    @return unsigned int     0, the image keeps its own memory.
+ */
+unsigned int platform_acquire_image(image_t *image) {
+    return 0;
+}
+
+/*
+ *    Returns the width and height of the screen.
+ *
+ *    @return vec2u_t      The width and height of the screen.
+ */
+vec2u_t platform_get_screen_size(void) {
+    return _screen_size;
+}
+
+/*
+ *    Pops an event of the current frame from the input script.
+ *
+ *    @param unsigned int *info    Additional information about the event.
+ *
+ *    @return char *    The event, or nullptr if there are no events.
+ */
+char *platform_get_event(unsigned int *info) {
+    script_event_t *e;
+
+    while (_script_next < _script_count && _script[_script_next].frame == _frame) {
+        e = &_script[_script_next++];
+
+        if (!e->mouse)
+            return e->alias;
+    }
+
+    return nullptr;
+}
+
+/*
+ *    Returns a joystick event, the mouse movement scripted for the
+ *    current frame.
+ *
+ *    @return vec2u_t      The joystick event.
+ */
+vec2u_t platform_get_joystick_event() {
+    return _mouse_delta;
+}
+
+/*
+ *    Writes data to the sound buffer, which is thrown away.
+ *
+ *    @param char *buf     The data to write.
+ *
+ *    @return unsigned int     1 if successful, 0 otherwise.
+ */
+unsigned int platform_write_sound(char *buf) {
+    return 1;
+}
+
+/*
+ *    Gets the playback bits per sample, sample rate, channels, and buffer size.
+ *
+ *    @param unsigned int *bits_per_samp    The bits per sample.
+ *    @param unsigned int *sample_rate      The sample rate.
+ *    @param unsigned int *num_channels     The channels.
+ *    @param unsigned int *buf_len          The buffer size.
+ */
+void platform_get_sound_info(unsigned int *bits_per_samp, unsigned int *sample_rate,
+                             unsigned int *num_channels, unsigned int *buf_len) {
+    *bits_per_samp = PCM_SAMPLE_WIDTH;
+    *sample_rate   = PCM_SAMPLE_RATE;
+    *num_channels  = PCM_CHANNELS;
+    *buf_len       = PCM_BUFFER_SIZE;
+}
+
+/*
+ *    Reads from stdin.
+ *
+ *    @return char *    The string read from stdin.
+ */
+char *platform_read_stdin() {
+#if __unix__
+    static char buf[MAX_STDIN_READ] = {0};
+
+    if (read(0, &buf, 1) > 0)
+        return buf;
+#endif /* __unix__  */
+
+    return nullptr;
+}
+
+/*
+ *    Initializes the platform.
+ *
+ *    @return unsigned int    1 if successful, 0 otherwise.
+ */
+unsigned int platform_init(void) {
+    int width  = args_get_int("-w");
+    int height = args_get_int("-h");
+
+    if (width > 0 && height > 0) {
+        _screen_size.x = width;
+        _screen_size.y = height;
+    }
+
+    _frame_limit = args_get_int("--frame-limit");
+    _dump_raw    = args_has("--dump-raw");
+
+    if (args_has("--dump-frames"))
+        _dump_dir = args_get_str("--dump-frames");
+
+    if (args_has("--input-script") && !input_parse_script(args_get_str("--input-script"))) {
+        LOGF_ERR("Unable to parse input script.\n");
+        return 0;
+    }
+
+#if __unix__
+    fcntl(0, F_SETFL, O_NONBLOCK);
+#endif /* __unix__  */
+
+    return 1;
+}
+
+/*
+ *    Updates the platform, moving on to the next frame of the input
+ *    script.
+ *
+ *    @param  float dt    Delta time.
+ *
+ *    @return unsigned int    1 if successful, 0 otherwise.
+ */
+unsigned int platform_update(float dt) {
+    unsigned int i;
+
+    _frame++;
+
+    /*
+     *    Skip whatever of earlier frames wasn't popped.
+     */
+    while (_script_next < _script_count && _script[_script_next].frame < _frame)
+        _script_next++;
+
+    _mouse_delta.x = 0;
+    _mouse_delta.y = 0;
+
+    for (i = _script_next; i < _script_count && _script[i].frame == _frame; i++) {
+        if (_script[i].mouse) {
+            _mouse_delta.x += _script[i].dx;
+            _mouse_delta.y += _script[i].dy;
+        }
+    }
+
+    if (_frame_limit > 0 && _frame > (unsigned int)_frame_limit)
+        return 0;
+
+    return 1;
+}
+
+/*
+ *    Cleans up the platform.
+ *
+ *    @return unsigned int    1 if successful, 0 otherwise.
+ */
+unsigned int platform_cleanup(void) {
+    free(_script);
+
+    _script       = nullptr;
+    _script_count = 0;
+    _script_next  = 0;
+
+    return 1;
+}
+
+CHIK_MODULE(platform_init, platform_update, platform_cleanup)